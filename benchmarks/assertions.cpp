@@ -0,0 +1,148 @@
+#include "../include/yatf.hpp"
+#include <cstdio>
+#include <vector>
+#include "common.hpp"
+
+// Throughput of passing assertions; the operands are read from memory, so
+// the compiler cannot prove the checks and fold them away
+namespace {
+
+const unsigned iterations = 100000000 / 256 * 256;
+const unsigned data_size = 1024;
+
+unsigned lhs_data[data_size];
+unsigned rhs_data[data_size];
+
+void fill_data() {
+    for (auto i = 0u; i < data_size; ++i) {
+        lhs_data[i] = rhs_data[i] = i * 2654435761u + 1;
+    }
+}
+
+void print_rate(const char *name, std::uint64_t start) {
+    auto ns = now_ns() - start;
+    std::printf("%-14s %8.1f M assertions/s\n", name, iterations * 1e3 / static_cast<double>(ns));
+}
+
+void print_bandwidth(const char *name, std::uint64_t bytes, std::uint64_t start) {
+    auto ns = now_ns() - start;
+    std::printf("%-14s %8.2f GB/s\n", name, static_cast<double>(bytes) / static_cast<double>(ns));
+}
+
+const std::size_t block_size = 4 << 20;
+const unsigned block_iterations = 64;
+
+} // namespace anon
+
+TEST(benchmark, require) {
+    fill_data();
+    auto start = now_ns();
+    for (auto i = 0u; i < iterations; ++i) {
+        REQUIRE(lhs_data[i % data_size]);
+    }
+    print_rate("REQUIRE", start);
+}
+
+TEST(benchmark, require_false) {
+    fill_data();
+    auto start = now_ns();
+    for (auto i = 0u; i < iterations; ++i) {
+        REQUIRE_FALSE(lhs_data[i % data_size] == 0);
+    }
+    print_rate("REQUIRE_FALSE", start);
+}
+
+TEST(benchmark, require_eq) {
+    fill_data();
+    auto start = now_ns();
+    for (auto i = 0u; i < iterations; ++i) {
+        REQUIRE_EQ(lhs_data[i % data_size], rhs_data[i % data_size]);
+    }
+    print_rate("REQUIRE_EQ", start);
+}
+
+TEST(benchmark, require_eq_str) {
+    const char *str = "benchmark";
+    auto start = now_ns();
+    for (auto i = 0u; i < iterations; ++i) {
+        REQUIRE_EQ(str + (lhs_data[i % data_size] & 1), str + (rhs_data[i % data_size] & 1));
+    }
+    print_rate("REQUIRE_EQ str", start);
+}
+
+TEST(benchmark, require_eq_loop) {
+    std::vector<unsigned char> a(block_size, 0x5a), b(block_size, 0x5a);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        for (auto j = 0u; j < block_size; ++j) {
+            REQUIRE_EQ(a[j], b[j]);
+        }
+    }
+    print_bandwidth("REQUIRE_EQ 4M", block_size * block_iterations, start);
+}
+
+TEST(benchmark, require_mem_eq) {
+    std::vector<unsigned char> a(block_size, 0x5a), b(block_size, 0x5a);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        REQUIRE_MEM_EQ(a.data(), b.data(), block_size);
+    }
+    print_bandwidth("REQUIRE_MEM 4M", block_size * block_iterations, start);
+}
+
+TEST(benchmark, require_range_eq) {
+    std::vector<int> a(block_size / sizeof(int), 0x5a), b(block_size / sizeof(int), 0x5a);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        REQUIRE_RANGE_EQ(a, b);
+    }
+    print_bandwidth("REQUIRE_RANGE", block_size * block_iterations, start);
+}
+
+TEST(benchmark, require_near_loop) {
+    std::vector<float> a(block_size / sizeof(float), 0.5f), b(block_size / sizeof(float), 0.5f);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        for (auto j = 0u; j < a.size(); ++j) {
+            REQUIRE_NEAR(a[j], b[j], 1e-6f);
+        }
+    }
+    print_bandwidth("REQUIRE_NEAR 1M", block_size * block_iterations, start);
+}
+
+TEST(benchmark, require_range_near) {
+    std::vector<float> a(block_size / sizeof(float), 0.5f), b(block_size / sizeof(float), 0.5f);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        REQUIRE_RANGE_NEAR(a, b, 1e-6f);
+    }
+    print_bandwidth("RANGE_NEAR 1M", block_size * block_iterations, start);
+}
+
+TEST(benchmark, require_range_ulp_eq) {
+    std::vector<float> a(block_size / sizeof(float), 0.5f), b(block_size / sizeof(float), 0.5f);
+    auto start = now_ns();
+    for (auto i = 0u; i < block_iterations; ++i) {
+        REQUIRE_RANGE_ULP_EQ(a, b, 4);
+    }
+    print_bandwidth("RANGE_ULP 1M", block_size * block_iterations, start);
+}
+
+// A test body with many distinct assertions, as in real tests; here the size
+// of the code emitted for every assertion matters
+#define YATF_BENCH_X4(x) x x x x
+#define YATF_BENCH_X256(x) YATF_BENCH_X4(YATF_BENCH_X4(YATF_BENCH_X4(YATF_BENCH_X4(x))))
+
+TEST(benchmark, many_sites) {
+    fill_data();
+    auto start = now_ns();
+    for (auto i = 0u; i < iterations / 256; ++i) {
+        auto j = i;
+        YATF_BENCH_X256(REQUIRE_EQ(lhs_data[j % data_size], rhs_data[j % data_size]); ++j;)
+    }
+    print_rate("many sites", start);
+}
+
+int main(int argc, const char *argv[]) {
+    return yatf::main(printf, static_cast<unsigned>(argc), argv);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <time.h>
+
+inline std::uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u + static_cast<std::uint64_t>(ts.tv_nsec);
+}
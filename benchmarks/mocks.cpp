@@ -0,0 +1,104 @@
+#include "../include/yatf.hpp"
+#include <cstdio>
+#include <vector>
+#include "common.hpp"
+
+// Calls of a mock with many expectations of exact arguments, as registered
+// by protocol simulations; integral arguments are looked up in the index,
+// key ones (not hashable) are compared with every handler in turn;
+// matchers are called for every handler
+namespace {
+
+const unsigned handlers_number = 10000;
+const unsigned calls = 200000;
+const unsigned matchers_number = 100;
+
+struct key {
+    unsigned value;
+
+    bool operator==(const key &other) const {
+        return value == other.value;
+    }
+};
+
+yatf::detail::mock<unsigned(unsigned)> indexed_mock;
+yatf::detail::mock<unsigned(key)> scanned_mock;
+yatf::detail::mock<unsigned(unsigned)> matched_mock;
+yatf::detail::mock<unsigned(unsigned)> combined_mock;
+yatf::detail::mock<unsigned(unsigned, unsigned)> lambda_mock;
+
+void print_rate(const char *name, std::uint64_t start) {
+    auto ns = now_ns() - start;
+    std::printf("%-14s %8.2f M calls/s\n", name, calls * 1e3 / static_cast<double>(ns));
+}
+
+} // namespace anon
+
+TEST(benchmark, indexed_mock) {
+    std::vector<yatf::detail::mock_handler<unsigned, unsigned>> handlers(handlers_number);
+    for (auto i = 0u; i < handlers_number; ++i) {
+        indexed_mock.register_handler(handlers[i]);
+        handlers[i].for_arguments(i).will_return(i + 1);
+    }
+    auto start = now_ns();
+    for (auto i = 0u; i < calls; ++i) {
+        auto arg = i * 7919u % handlers_number;
+        REQUIRE_EQ(indexed_mock(arg), arg + 1);
+    }
+    print_rate("mock 10k idx", start);
+}
+
+TEST(benchmark, scanned_mock) {
+    std::vector<yatf::detail::mock_handler<unsigned, key>> handlers(handlers_number);
+    for (auto i = 0u; i < handlers_number; ++i) {
+        scanned_mock.register_handler(handlers[i]);
+        handlers[i].for_arguments(key{i}).will_return(i + 1);
+    }
+    auto start = now_ns();
+    for (auto i = 0u; i < calls; ++i) {
+        auto arg = i * 7919u % handlers_number;
+        REQUIRE_EQ(scanned_mock(key{arg}), arg + 1);
+    }
+    print_rate("mock 10k scan", start);
+}
+
+TEST(benchmark, matched_mock) {
+    std::vector<yatf::detail::mock_handler<unsigned, unsigned>> handlers(matchers_number);
+    for (auto i = 0u; i < matchers_number; ++i) {
+        matched_mock.register_handler(handlers[i]);
+        handlers[i].for_arguments(yatf::eq(i)).will_return(i + 1);
+    }
+    auto start = now_ns();
+    for (auto i = 0u; i < calls; ++i) {
+        auto arg = i * 7919u % matchers_number;
+        REQUIRE_EQ(matched_mock(arg), arg + 1);
+    }
+    print_rate("mock 100 eq()", start);
+}
+
+TEST(benchmark, combined_mock) {
+    std::vector<yatf::detail::mock_handler<unsigned, unsigned>> handlers(matchers_number);
+    for (auto i = 0u; i < matchers_number; ++i) {
+        combined_mock.register_handler(handlers[i]);
+        handlers[i].for_arguments(yatf::all_of(yatf::ge(i), yatf::le(i), !yatf::eq(matchers_number))).will_return(i + 1);
+    }
+    auto start = now_ns();
+    for (auto i = 0u; i < calls; ++i) {
+        auto arg = i * 7919u % matchers_number;
+        REQUIRE_EQ(combined_mock(arg), arg + 1);
+    }
+    print_rate("mock 100 all_of", start);
+}
+
+TEST(benchmark, lambda_mock) {
+    std::vector<yatf::detail::mock_handler<unsigned, unsigned, unsigned>> handlers(matchers_number);
+    for (auto i = 0u; i < matchers_number; ++i) {
+        lambda_mock.register_handler(handlers[i]);
+        handlers[i].match_args([](unsigned a, unsigned b) { return a == b; }).will_return(i + 1);
+    }
+    auto start = now_ns();
+    for (auto i = 0u; i < calls; ++i) {
+        REQUIRE_EQ(lambda_mock(i, i + 1), 0u);
+    }
+    print_rate("mock 100 lambda", start);
+}
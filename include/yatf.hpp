@@ -1,30 +1,340 @@
 #pragma once
 
+#include <csetjmp>
+#include <cstdarg>
+#include <cstdint>
 #include <type_traits>
 
+#ifndef YATF_POSIX
+#if defined(__unix__) || defined(__APPLE__)
+#define YATF_POSIX 1
+#else
+#define YATF_POSIX 0
+#endif
+#endif
+
+#ifndef YATF_MAX_FILTER_PATTERNS
+#define YATF_MAX_FILTER_PATTERNS 16
+#endif
+
+#ifndef YATF_MAX_SLOWEST
+#define YATF_MAX_SLOWEST 32
+#endif
+
+#ifndef YATF_PRINTER_BUFFER_SIZE
+#define YATF_PRINTER_BUFFER_SIZE 256
+#endif
+
+#ifndef YATF_ASYNC_OUTPUT
+#define YATF_ASYNC_OUTPUT YATF_POSIX
+#endif
+
+#ifndef YATF_ASYNC_BUFFER_SIZE
+#define YATF_ASYNC_BUFFER_SIZE 16384
+#endif
+
+#ifndef YATF_STRIP_STRINGS
+#define YATF_STRIP_STRINGS 0
+#endif
+
+#ifndef YATF_CALL_SITES
+#define YATF_CALL_SITES YATF_STRIP_STRINGS
+#endif
+
+#if YATF_STRIP_STRINGS && !YATF_CALL_SITES
+#error "YATF_STRIP_STRINGS requires YATF_CALL_SITES"
+#endif
+
+// Call sites are placed in named sections, so only ELF targets built with
+// GCC-compatible compilers are supported
+#if YATF_CALL_SITES && !(defined(__GNUC__) && defined(__ELF__))
+#error "YATF_CALL_SITES requires an ELF target and GCC or Clang"
+#endif
+
+#ifndef YATF_MAX_FAILURE_SITES
+#define YATF_MAX_FAILURE_SITES 16
+#endif
+
+// Reporter built into the session: ANY selects text, JUnit, JSON, TAP or
+// binary output at run time; TEXT, BINARY and SILENT leave other reporters
+// (and virtual dispatch) out of the image
+#define YATF_REPORTER_ANY 0
+#define YATF_REPORTER_TEXT 1
+#define YATF_REPORTER_BINARY 2
+#define YATF_REPORTER_SILENT 3
+
+#ifndef YATF_REPORTER
+#define YATF_REPORTER YATF_REPORTER_ANY
+#endif
+
+#ifndef YATF_TEST_INDEX_BUCKETS
+#if YATF_POSIX
+#define YATF_TEST_INDEX_BUCKETS 4096
+#else
+#define YATF_TEST_INDEX_BUCKETS 64
+#endif
+#endif
+
+#ifndef YATF_MOCK_INDEX_BUCKETS
+#if YATF_POSIX
+#define YATF_MOCK_INDEX_BUCKETS 1024
+#else
+#define YATF_MOCK_INDEX_BUCKETS 8
+#endif
+#endif
+
+#ifndef YATF_MOCK_CALL_LOG_SIZE
+#if YATF_POSIX
+#define YATF_MOCK_CALL_LOG_SIZE 16
+#else
+#define YATF_MOCK_CALL_LOG_SIZE 4
+#endif
+#endif
+
+#ifndef YATF_THREAD_SAFE_MOCKS
+#define YATF_THREAD_SAFE_MOCKS YATF_POSIX
+#endif
+
+// Bytes kept inline for a matcher (e.g. captures of a lambda); matchers of
+// a single argument get room for two more values of it. A bigger matcher
+// doesn't compile
+#ifndef YATF_MATCHER_SIZE
+#define YATF_MATCHER_SIZE (4 * sizeof(void *))
+#endif
+
+// Instruction set used by REQUIRE_RANGE_EQ and REQUIRE_MEM_EQ to compare
+// memory; NONE compares byte by byte
+#define YATF_SIMD_NONE 0
+#define YATF_SIMD_SSE2 1
+#define YATF_SIMD_AVX2 2
+
+#ifndef YATF_SIMD
+#if defined(__AVX2__)
+#define YATF_SIMD YATF_SIMD_AVX2
+#elif defined(__SSE2__)
+#define YATF_SIMD YATF_SIMD_SSE2
+#else
+#define YATF_SIMD YATF_SIMD_NONE
+#endif
+#endif
+
+#if YATF_POSIX
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <poll.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#define YATF_THREAD_LOCAL thread_local
+#else
+#define YATF_THREAD_LOCAL
+#endif
+
+// Failure paths of the assertions are kept out of line, so the passing
+// assertion is only a compare and a counter increment
+#if defined(__GNUC__)
+#define YATF_COLD __attribute__((cold, noinline))
+#define YATF_UNLIKELY(cond) __builtin_expect(!!(cond), 0)
+#else
+#define YATF_COLD
+#define YATF_UNLIKELY(cond) (cond)
+#endif
+
+#if YATF_ASYNC_OUTPUT || YATF_THREAD_SAFE_MOCKS
+#include <atomic>
+#endif
+
+#if YATF_SIMD == YATF_SIMD_AVX2
+#include <immintrin.h>
+#elif YATF_SIMD == YATF_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
 struct yatf_fixture;
 
 namespace yatf {
 
+enum class overflow_policy { block, drop };
+
+enum class reporter_type { text, junit, json, tap };
+
+// Writes size bytes of binary data
+using write_t = int (*)(const void *, std::size_t);
+
 struct config final {
 
     bool color;
     bool oneliners;
     bool fails_only;
-
-    explicit config(bool color = true, bool oneliners = false, bool fails_only = false)
+    unsigned jobs;
+    bool isolate;
+    unsigned timeout_ms;
+    const char *filter;
+    unsigned slowest;
+    unsigned shard_index;
+    unsigned shard_count;
+    const char *history;
+    unsigned max_failures;
+    unsigned max_failures_per_site;
+    bool async_output;
+    overflow_policy overflow;
+    write_t binary_output;
+    reporter_type reporter;
+    const char *out;
+    const char *bad_option;
+
+    explicit config(bool color = true, bool oneliners = false, bool fails_only = false, unsigned jobs = 1,
+            bool isolate = false, unsigned timeout_ms = 0, const char *filter = nullptr, unsigned slowest = 0,
+            unsigned shard_index = 0, unsigned shard_count = 0, const char *history = nullptr,
+            unsigned max_failures = 0, unsigned max_failures_per_site = 0, bool async_output = false,
+            overflow_policy overflow = overflow_policy::block, write_t binary_output = nullptr,
+            reporter_type reporter = reporter_type::text, const char *out = nullptr,
+            const char *bad_option = nullptr)
         : color(color)
         , oneliners(oneliners)
-        , fails_only(fails_only) {
+        , fails_only(fails_only)
+        , jobs(jobs)
+        , isolate(isolate)
+        , timeout_ms(timeout_ms)
+        , filter(filter)
+        , slowest(slowest)
+        , shard_index(shard_index)
+        , shard_count(shard_count)
+        , history(history)
+        , max_failures(max_failures)
+        , max_failures_per_site(max_failures_per_site)
+        , async_output(async_output)
+        , overflow(overflow)
+        , binary_output(binary_output)
+        , reporter(reporter)
+        , out(out)
+        , bad_option(bad_option) {
     }
 };
 
 using printf_t = int (*)(const char *, ...);
 
+// Returns monotonic time in nanoseconds
+using clock_func_t = std::uint64_t (*)();
+
 namespace detail {
 
 struct empty_fixture {};
 
+// Call site record created by YATF_SITE for the host-side decoder: line
+// and three null-terminated strings - file and two names (e.g. condition,
+// or suite and test name). Records are pure data placed in yatf_sites.*
+// sections; a site id is a record's offset from the anchor, which is the
+// only object in the yatf_sites section
+template <std::size_t Size>
+struct site_record final {
+    std::uint32_t line;
+    char strings[Size];
+};
+
+#if YATF_CALL_SITES
+
+inline const char *site_anchor() {
+    static const char anchor __attribute__((section("yatf_sites"))) = 0;
+    return &anchor;
+}
+
+inline std::int32_t site_id(const void *record) {
+    return static_cast<std::int32_t>(reinterpret_cast<std::intptr_t>(record) -
+        reinterpret_cast<std::intptr_t>(site_anchor()));
+}
+
+#endif
+
+// Copies the representation of a value to an object of another type of
+// the same size (compilers turn it into a move)
+template <typename To, typename From>
+inline To bit_cast(const From &from) {
+    static_assert(sizeof(To) == sizeof(From), "bit_cast needs types of the same size");
+    To to;
+    auto src = reinterpret_cast<const unsigned char *>(&from);
+    auto dest = reinterpret_cast<unsigned char *>(&to);
+    for (auto i = 0u; i < sizeof(To); ++i) {
+        dest[i] = src[i];
+    }
+    return to;
+}
+
+// Fixed-size record of the binary result stream written to
+// config::binary_output instead of text; fields are in the byte order of
+// the target. A failure is followed by its value records
+struct binary_record final {
+
+    enum type_t : std::uint8_t {
+        session_start = 1,  // value: number of test cases
+        test_start,         // site: test, value: hash of the test name
+        failure,            // site: assertion, kind: failure_t, values: number of value records
+        failure_value,      // kind: value_t
+        suppressed,         // site: assertion (0 for other locations), value: number of failures
+        duration,           // value: duration of the test in ns
+        test_end,           // site: test, value: assertions | failed << 32
+        session_end,        // value: number of failed test cases
+        test_crash,         // site: test, kind: signal (0 if it exited), value: exit code
+        test_timeout        // site: test, value: timeout in ms
+    };
+
+    enum failure_t : std::uint8_t {
+        is_false, is_true, not_equal, bad_call_count, range_not_equal, not_near, not_ulp_equal, range_not_near,
+        range_not_ulp_equal, out_of_sequence
+    };
+
+    // Floating-point values are sent as the bits of a double
+    enum value_t : std::uint8_t { unsigned_value, signed_value, float_value, double_value };
+
+    std::uint8_t type;
+    std::uint8_t kind;
+    std::uint16_t values;
+    std::int32_t site;
+    std::uint64_t value;
+};
+
+static_assert(sizeof(binary_record) == 16, "binary_record has to be packed");
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value, bool>::type to_binary_value(const T &v,
+        binary_record &record) {
+    record = binary_record{binary_record::failure_value,
+        std::is_signed<T>::value ? binary_record::signed_value : binary_record::unsigned_value, 0, 0,
+        static_cast<std::uint64_t>(v)};
+    return true;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, bool>::type to_binary_value(const T &v,
+        binary_record &record) {
+    record = binary_record{binary_record::failure_value,
+        sizeof(T) <= sizeof(float) ? binary_record::float_value : binary_record::double_value, 0, 0,
+        bit_cast<std::uint64_t>(static_cast<double>(v))};
+    return true;
+}
+
+template <typename T>
+inline typename std::enable_if<!std::is_arithmetic<T>::value, bool>::type to_binary_value(const T &, binary_record &) {
+    return false;
+}
+
+template <typename Fixture>
+constexpr unsigned fixture_timeout(decltype(Fixture::yatf_timeout_ms) *) {
+    return Fixture::yatf_timeout_ms;
+}
+
+template <typename Fixture>
+constexpr unsigned fixture_timeout(...) {
+    return 0;
+}
+
 inline int compare_strings(const char *s1, const char *s2) {
     while(*s1 && (*s1 == *s2)) {
         ++s1, ++s2;
@@ -32,46 +342,615 @@ inline int compare_strings(const char *s1, const char *s2) {
     return *s1 - *s2;
 }
 
-inline char *find(char *str, char c) {
+#if YATF_SIMD == YATF_SIMD_AVX2
+using simd_vector = __m256i;
+
+inline simd_vector simd_equal(const unsigned char *a, const unsigned char *b) {
+    return _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)));
+}
+
+inline simd_vector simd_and(simd_vector a, simd_vector b) {
+    return _mm256_and_si256(a, b);
+}
+
+// Returns a mask with bits set for bytes which are not equal
+inline std::uint32_t simd_mismatches(simd_vector equal) {
+    return ~static_cast<std::uint32_t>(_mm256_movemask_epi8(equal));
+}
+
+inline __m256 simd_load(const float *p) {
+    return _mm256_loadu_ps(p);
+}
+
+inline __m256d simd_load(const double *p) {
+    return _mm256_loadu_pd(p);
+}
+
+inline __m256 simd_set(float value) {
+    return _mm256_set1_ps(value);
+}
+
+inline __m256d simd_set(double value) {
+    return _mm256_set1_pd(value);
+}
+
+// Returns a mask with bits set for lanes which are equal or differ by at
+// most tolerance (never for NaN)
+inline unsigned simd_near(__m256 a, __m256 b, __m256 tolerance) {
+    auto difference = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(a, b));
+    return static_cast<unsigned>(_mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ),
+        _mm256_cmp_ps(difference, tolerance, _CMP_LE_OQ))));
+}
+
+inline unsigned simd_near(__m256d a, __m256d b, __m256d tolerance) {
+    auto difference = _mm256_andnot_pd(_mm256_set1_pd(-0.0), _mm256_sub_pd(a, b));
+    return static_cast<unsigned>(_mm256_movemask_pd(_mm256_or_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ),
+        _mm256_cmp_pd(difference, tolerance, _CMP_LE_OQ))));
+}
+
+// Returns a mask with bits set for lanes which are at most max_ulps (up
+// to 2^32 - 1) apart; see ulp_distance()
+inline unsigned simd_ulp_near(const float *a, const float *b, std::uint32_t max_ulps) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+    auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+    auto magnitude = _mm256_set1_epi32(0x7fffffff);
+    auto infinity = _mm256_set1_epi32(0x7f800000);
+    auto bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    auto x_magnitude = _mm256_and_si256(x, magnitude);
+    auto y_magnitude = _mm256_and_si256(y, magnitude);
+    auto signs_differ = _mm256_srai_epi32(_mm256_xor_si256(x, y), 31);
+    auto difference = _mm256_abs_epi32(_mm256_sub_epi32(x_magnitude, y_magnitude));
+    auto distance = _mm256_or_si256(_mm256_and_si256(signs_differ, _mm256_add_epi32(x_magnitude, y_magnitude)),
+        _mm256_andnot_si256(signs_differ, difference));
+    auto far = _mm256_or_si256(
+        _mm256_cmpgt_epi32(_mm256_xor_si256(distance, bias), _mm256_set1_epi32(static_cast<int>(max_ulps ^ 0x80000000u))),
+        _mm256_or_si256(_mm256_cmpgt_epi32(x_magnitude, infinity), _mm256_cmpgt_epi32(y_magnitude, infinity)));
+    return ~static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(far))) & 0xffu;
+}
+#elif YATF_SIMD == YATF_SIMD_SSE2
+using simd_vector = __m128i;
+
+inline simd_vector simd_equal(const unsigned char *a, const unsigned char *b) {
+    return _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b)));
+}
+
+inline simd_vector simd_and(simd_vector a, simd_vector b) {
+    return _mm_and_si128(a, b);
+}
+
+inline std::uint32_t simd_mismatches(simd_vector equal) {
+    return ~static_cast<std::uint32_t>(_mm_movemask_epi8(equal)) & 0xffffu;
+}
+
+inline __m128 simd_load(const float *p) {
+    return _mm_loadu_ps(p);
+}
+
+inline __m128d simd_load(const double *p) {
+    return _mm_loadu_pd(p);
+}
+
+inline __m128 simd_set(float value) {
+    return _mm_set1_ps(value);
+}
+
+inline __m128d simd_set(double value) {
+    return _mm_set1_pd(value);
+}
+
+inline unsigned simd_near(__m128 a, __m128 b, __m128 tolerance) {
+    auto difference = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(a, b));
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_or_ps(_mm_cmpeq_ps(a, b), _mm_cmple_ps(difference, tolerance))));
+}
+
+inline unsigned simd_near(__m128d a, __m128d b, __m128d tolerance) {
+    auto difference = _mm_andnot_pd(_mm_set1_pd(-0.0), _mm_sub_pd(a, b));
+    return static_cast<unsigned>(_mm_movemask_pd(_mm_or_pd(_mm_cmpeq_pd(a, b), _mm_cmple_pd(difference, tolerance))));
+}
+
+inline unsigned simd_ulp_near(const float *a, const float *b, std::uint32_t max_ulps) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+    auto y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    auto magnitude = _mm_set1_epi32(0x7fffffff);
+    auto infinity = _mm_set1_epi32(0x7f800000);
+    auto bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    auto x_magnitude = _mm_and_si128(x, magnitude);
+    auto y_magnitude = _mm_and_si128(y, magnitude);
+    auto signs_differ = _mm_srai_epi32(_mm_xor_si128(x, y), 31);
+    auto difference = _mm_sub_epi32(x_magnitude, y_magnitude);
+    auto difference_sign = _mm_srai_epi32(difference, 31);
+    difference = _mm_sub_epi32(_mm_xor_si128(difference, difference_sign), difference_sign);
+    auto distance = _mm_or_si128(_mm_and_si128(signs_differ, _mm_add_epi32(x_magnitude, y_magnitude)),
+        _mm_andnot_si128(signs_differ, difference));
+    auto far = _mm_or_si128(
+        _mm_cmpgt_epi32(_mm_xor_si128(distance, bias), _mm_set1_epi32(static_cast<int>(max_ulps ^ 0x80000000u))),
+        _mm_or_si128(_mm_cmpgt_epi32(x_magnitude, infinity), _mm_cmpgt_epi32(y_magnitude, infinity)));
+    return ~static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(far))) & 0xfu;
+}
+#endif
+
+// Returns the offset of the first byte which differs in a and b, or size
+// if the blocks are equal
+inline std::size_t find_byte_mismatch(const unsigned char *a, const unsigned char *b, std::size_t size) {
+    std::size_t i = 0;
+#if YATF_SIMD != YATF_SIMD_NONE
+    const auto step = sizeof(simd_vector);
+    // Blocks are expected to be equal, so four vectors are checked at once
+    // and the one which differs is found afterwards
+    for (; i + 4 * step <= size; i += 4 * step) {
+        auto equal = simd_and(
+            simd_and(simd_equal(a + i, b + i), simd_equal(a + i + step, b + i + step)),
+            simd_and(simd_equal(a + i + 2 * step, b + i + 2 * step), simd_equal(a + i + 3 * step, b + i + 3 * step)));
+        if (simd_mismatches(equal)) {
+            break;
+        }
+    }
+    for (; i + step <= size; i += step) {
+        auto mismatches = simd_mismatches(simd_equal(a + i, b + i));
+        if (mismatches) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mismatches));
+        }
+    }
+#endif
+    while (i < size && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+inline std::size_t count_byte_mismatches(const unsigned char *a, const unsigned char *b, std::size_t size) {
+    std::size_t count = 0, i = 0;
+#if YATF_SIMD != YATF_SIMD_NONE
+    for (; i + sizeof(simd_vector) <= size; i += sizeof(simd_vector)) {
+        count += static_cast<std::size_t>(__builtin_popcount(simd_mismatches(simd_equal(a + i, b + i))));
+    }
+#endif
+    for (; i < size; ++i) {
+        count += a[i] != b[i];
+    }
+    return count;
+}
+
+// Elements which are equal if and only if their bytes are equal
+template <typename T>
+struct is_memory_comparable : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value> {
+};
+
+// Index of the first element which differs in a and b, or size if the
+// ranges are equal
+template <typename T1, typename T2>
+inline std::size_t find_mismatch(const T1 *a, const T2 *b, std::size_t size) {
+    std::size_t i = 0;
+    while (i < size && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+template <typename T>
+inline typename std::enable_if<is_memory_comparable<T>::value, std::size_t>::type find_mismatch(const T *a,
+        const T *b, std::size_t size) {
+    return find_byte_mismatch(reinterpret_cast<const unsigned char *>(a), reinterpret_cast<const unsigned char *>(b),
+        size * sizeof(T)) / sizeof(T);
+}
+
+template <typename T1, typename T2>
+inline std::size_t count_mismatches(const T1 *a, const T2 *b, std::size_t size) {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        count += !(a[i] == b[i]);
+    }
+    return count;
+}
+
+template <typename T>
+inline typename std::enable_if<is_memory_comparable<T>::value && sizeof(T) == 1, std::size_t>::type
+count_mismatches(const T *a, const T *b, std::size_t size) {
+    return count_byte_mismatches(reinterpret_cast<const unsigned char *>(a),
+        reinterpret_cast<const unsigned char *>(b), size);
+}
+
+template <typename T1, typename T2, typename T3>
+inline bool is_near(const T1 &a, const T2 &b, const T3 &tolerance) {
+    return a == b || (a > b ? a - b : b - a) <= tolerance;
+}
+
+template <typename T1, typename T2>
+inline double near_error(const T1 &a, const T2 &b) {
+    return a == b ? 0.0 : static_cast<double>(a > b ? a - b : b - a);
+}
+
+// Number of steps between representable values from a to b; zeros of
+// both signs are equal and NaN is never near anything
+template <typename T>
+inline std::uint64_t ulp_distance(const T &a, const T &b) {
+    using bits_t = typename std::conditional<sizeof(T) == sizeof(std::uint32_t), std::uint32_t, std::uint64_t>::type;
+    static_assert(std::is_floating_point<T>::value && sizeof(T) == sizeof(bits_t),
+        "ULP distance is defined for float and double");
+    if (a != a || b != b) {
+        return ~0ull;
+    }
+    const auto sign = static_cast<bits_t>(1) << (sizeof(T) * 8 - 1);
+    auto x = bit_cast<bits_t>(a);
+    auto y = bit_cast<bits_t>(b);
+    std::uint64_t x_magnitude = x & ~sign;
+    std::uint64_t y_magnitude = y & ~sign;
+    if ((x ^ y) & sign) {
+        return x_magnitude + y_magnitude;
+    }
+    return x_magnitude > y_magnitude ? x_magnitude - y_magnitude : y_magnitude - x_magnitude;
+}
+
+template <typename T>
+inline double ulp_error(const T &a, const T &b) {
+    auto distance = ulp_distance(a, b);
+    return distance == ~0ull ? (a != a ? a : b) : static_cast<double>(distance);
+}
+
+// Index of the first element which isn't near the other one, or size
+template <typename T1, typename T2, typename T3>
+inline std::size_t find_not_near(const T1 *a, const T2 *b, std::size_t size, const T3 &tolerance) {
+    std::size_t i = 0;
+    while (i < size && is_near(a[i], b[i], tolerance)) {
+        ++i;
+    }
+    return i;
+}
+
+#if YATF_SIMD != YATF_SIMD_NONE
+template <typename T>
+inline std::size_t find_not_near_simd(const T *a, const T *b, std::size_t size, T tolerance) {
+    const auto lanes = sizeof(simd_vector) / sizeof(T);
+    const auto all = (1u << lanes) - 1;
+    auto simd_tolerance = simd_set(tolerance);
+    std::size_t i = 0;
+    for (; i + lanes <= size; i += lanes) {
+        auto near = simd_near(simd_load(a + i), simd_load(b + i), simd_tolerance);
+        if (near != all) {
+            return i + static_cast<std::size_t>(__builtin_ctz(~near & all));
+        }
+    }
+    return i + find_not_near(a + i, b + i, size - i, tolerance);
+}
+
+inline std::size_t find_not_near(const float *a, const float *b, std::size_t size, float tolerance) {
+    return find_not_near_simd(a, b, size, tolerance);
+}
+
+inline std::size_t find_not_near(const double *a, const double *b, std::size_t size, double tolerance) {
+    return find_not_near_simd(a, b, size, tolerance);
+}
+#endif
+
+template <typename T>
+inline std::size_t find_not_ulp_equal(const T *a, const T *b, std::size_t size, std::uint64_t max_ulps) {
+    std::size_t i = 0;
+    while (i < size && ulp_distance(a[i], b[i]) <= max_ulps) {
+        ++i;
+    }
+    return i;
+}
+
+#if YATF_SIMD != YATF_SIMD_NONE
+inline std::size_t find_not_ulp_equal(const float *a, const float *b, std::size_t size, std::uint64_t max_ulps) {
+    const auto lanes = sizeof(simd_vector) / sizeof(float);
+    const auto all = (1u << lanes) - 1;
+    std::size_t i = 0;
+    for (; max_ulps <= 0xffffffffu && i + lanes <= size; i += lanes) {
+        auto near = simd_ulp_near(a + i, b + i, static_cast<std::uint32_t>(max_ulps));
+        if (near != all) {
+            return i + static_cast<std::size_t>(__builtin_ctz(~near & all));
+        }
+    }
+    return i + find_not_ulp_equal<float>(a + i, b + i, size - i, max_ulps);
+}
+#endif
+
+// Checks of REQUIRE_RANGE_NEAR and REQUIRE_RANGE_ULP_EQ used when looking
+// for the maximum error
+template <typename T>
+struct near_check final {
+    T tolerance;
+
+    template <typename T1, typename T2>
+    bool within(const T1 &a, const T2 &b) const {
+        return is_near(a, b, tolerance);
+    }
+
+    template <typename T1, typename T2>
+    double error(const T1 &a, const T2 &b) const {
+        return near_error(a, b);
+    }
+
+    double limit() const {
+        return static_cast<double>(tolerance);
+    }
+};
+
+struct ulp_check final {
+    std::uint64_t max_ulps;
+
+    template <typename T>
+    bool within(const T &a, const T &b) const {
+        return ulp_distance(a, b) <= max_ulps;
+    }
+
+    template <typename T>
+    double error(const T &a, const T &b) const {
+        return ulp_error(a, b);
+    }
+
+    double limit() const {
+        return static_cast<double>(max_ulps);
+    }
+};
+
+// Significant digits needed to print all values of T
+template <typename T>
+constexpr int max_digits() {
+    return sizeof(T) <= sizeof(float) ? 9 : 17;
+}
+
+template <typename T, std::size_t N>
+inline const T *range_data(const T (&array)[N]) {
+    return array;
+}
+
+template <typename T, std::size_t N>
+constexpr std::size_t range_size(const T (&)[N]) {
+    return N;
+}
+
+template <typename Range>
+inline auto range_data(const Range &range) -> decltype(range.data()) {
+    return range.data();
+}
+
+template <typename Range>
+inline auto range_size(const Range &range) -> decltype(static_cast<std::size_t>(range.size())) {
+    return static_cast<std::size_t>(range.size());
+}
+
+inline std::uint32_t hash_string(const char *str, std::uint32_t hash = 2166136261u) {
     while (*str) {
-        if (*str == c) {
-            return str;
+        hash ^= static_cast<unsigned char>(*str++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a of "suite.name"; stable across builds and independent of the
+// registration order
+inline std::uint32_t hash_test_name(const char *suite, const char *name) {
+    return hash_string(name, hash_string(".", hash_string(suite)));
+}
+
+inline const char *skip_prefix(const char *str, const char *prefix) {
+    while (*prefix) {
+        if (*str++ != *prefix++) {
+            return nullptr;
         }
-        ++str;
     }
-    return nullptr;
+    return str;
+}
+
+inline bool parse_reporter(const char *str, reporter_type &type) {
+    static const char *names[] = {"text", "junit", "json", "tap"};
+    for (auto i = 0u; i < sizeof(names) / sizeof(*names); ++i) {
+        if (!compare_strings(str, names[i])) {
+            type = static_cast<reporter_type>(i);
+            return true;
+        }
+    }
+    return false;
 }
 
-inline void copy_string(const char *src, char *dest) {
-    while (*src) {
-        *dest++ = *src++;
+// Accepts only decimal numbers which fit in unsigned
+inline bool parse_unsigned(const char *str, unsigned &value) {
+    unsigned long long result = 0;
+    if (!*str) {
+        return false;
     }
-    *dest = 0;
+    for (; *str; ++str) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+        result = result * 10 + static_cast<unsigned>(*str - '0');
+        if (result > static_cast<unsigned>(-1)) {
+            return false;
+        }
+    }
+    value = static_cast<unsigned>(result);
+    return true;
 }
 
+// Test filter in form of "pattern[:pattern...]", where each pattern is
+// a glob ('*' and '?') matched against "suite.name"; patterns starting
+// with '-' exclude tests. The filter string is parsed once and patterns
+// refer to it, so it has to outlive the filter.
+struct test_filter final {
+
+    bool compile(const char *str) {
+        positive_ = negative_ = 0;
+        while (str && *str) {
+            auto end = str;
+            while (*end && *end != ':') {
+                ++end;
+            }
+            auto negative = *str == '-';
+            if (negative) {
+                ++str;
+            }
+            if (str != end) {
+                auto &count = negative ? negative_ : positive_;
+                if (count == YATF_MAX_FILTER_PATTERNS) {
+                    return false;
+                }
+                (negative ? negative_patterns_ : positive_patterns_)[count++] = pattern{str, end};
+            }
+            str = *end ? end + 1 : end;
+        }
+        return true;
+    }
+
+    bool matches(const char *suite, const char *name) const {
+        auto selected = positive_ == 0;
+        for (auto i = 0u; i < positive_ && !selected; ++i) {
+            selected = glob_match(positive_patterns_[i], name_cursor{suite, name});
+        }
+        for (auto i = 0u; i < negative_ && selected; ++i) {
+            selected = !glob_match(negative_patterns_[i], name_cursor{suite, name});
+        }
+        return selected;
+    }
+
+private:
+    struct pattern {
+        const char *begin;
+        const char *end;
+    };
+
+    // Walks "suite.name" without building it
+    struct name_cursor {
+        const char *current;
+        const char *rest;
+
+        char get() const {
+            return *current ? *current : '.';
+        }
+
+        bool end() const {
+            return !rest && !*current;
+        }
+
+        void next() {
+            if (*current) {
+                ++current;
+            }
+            else {
+                current = rest;
+                rest = nullptr;
+            }
+        }
+    };
+
+    static bool glob_match(const pattern &p, name_cursor str) {
+        auto it = p.begin;
+        const char *star = nullptr;
+        auto star_str = str;
+        while (!str.end()) {
+            if (it != p.end && (*it == '?' || *it == str.get())) {
+                ++it;
+                str.next();
+            }
+            else if (it != p.end && *it == '*') {
+                star = it++;
+                star_str = str;
+            }
+            else if (star) {
+                it = star + 1;
+                star_str.next();
+                str = star_str;
+            }
+            else {
+                return false;
+            }
+        }
+        while (it != p.end && *it == '*') {
+            ++it;
+        }
+        return it == p.end;
+    }
+
+    pattern positive_patterns_[YATF_MAX_FILTER_PATTERNS];
+    pattern negative_patterns_[YATF_MAX_FILTER_PATTERNS];
+    unsigned positive_ = 0;
+    unsigned negative_ = 0;
+};
+
+// Prints through the injected printf. Values are converted to text by
+// the printer itself, so printf only receives finished strings ("%s").
+// When initialized with a buffer, output is collected in it and handed
+// to printf as whole lines; the buffer is flushed on newline, when it's
+// full and on flush()
 struct printer final {
 
     enum class cursor_movement { up };
     enum class color { red, green, reset };
 
     void initialize(const printf_t printf) {
+        flush();
+        printf_ = printf;
+        buffer_ = nullptr;
+        size_ = 0;
+    }
+
+    void initialize(const printf_t printf, char *buffer, std::size_t size) {
+        flush();
         printf_ = printf;
+        buffer_ = size > 1 ? buffer : nullptr;
+        size_ = size;
+    }
+
+    void flush() {
+        if (used_) {
+            buffer_[used_] = 0;
+            used_ = 0;
+            printf_("%s", buffer_);
+        }
     }
 
     template <typename T>
     typename std::enable_if<
-        std::is_signed<T>::value, printer &
+        std::is_integral<T>::value && std::is_signed<T>::value, printer &
     >::type operator<<(T a) {
-        printf_("%d", a);
-        return *this;
+        char str[24];
+        auto begin = format_decimal(a < 0 ? 0 - static_cast<unsigned long long>(a) : a, str + sizeof(str));
+        if (a < 0) {
+            *--begin = '-';
+        }
+        return write(begin);
     }
 
     template <typename T>
     typename std::enable_if<
         std::is_unsigned<T>::value, printer &
     >::type operator<<(T a) {
-        printf_("%u", a);
-        return *this;
+        char str[24];
+        return write(format_decimal(a, str + sizeof(str)));
+    }
+
+    template <typename T>
+    typename std::enable_if<
+        std::is_floating_point<T>::value, printer &
+    >::type operator<<(T a) {
+        char str[24];
+        format_float(a, str);
+        return write(str);
+    }
+
+    // Floating-point value printed with the given number of significant
+    // digits (up to 17)
+    struct precise final {
+        double value;
+        int digits;
+    };
+
+    printer &operator<<(precise p) {
+        char str[32];
+        format_float(p.value, str, p.digits);
+        return write(str);
+    }
+
+    // Digits needed to tell a and b apart: 6 as usual, or max_digits if
+    // they look the same with 6
+    static int distinct_digits(double a, double b, int max_digits) {
+        char a_str[24], b_str[24];
+        format_float(a, a_str);
+        format_float(b, b_str);
+        return a != b && compare_strings(a_str, b_str) == 0 ? max_digits : 6;
     }
 
     template <typename T>
@@ -79,12 +958,39 @@ struct printer final {
         std::is_same<T, char *>::value ||
         std::is_same<T, const char *>::value, printer &
     >::type operator<<(T str) {
-        printf_(str);
-        return *this;
+        return write(str);
     }
 
     printer &operator<<(char c) {
-        printf_("%c", c);
+        return write(&c, 1);
+    }
+
+    printer &write(const char *str) {
+        if (buffer_) {
+            append(str);
+        }
+        else {
+            printf_("%s", str);
+        }
+        return *this;
+    }
+
+    printer &write(const char *str, std::size_t length) {
+        if (buffer_) {
+            append(str, length);
+            return *this;
+        }
+        char chunk[64];
+        while (length) {
+            auto size = length < sizeof(chunk) - 1 ? length : sizeof(chunk) - 1;
+            for (auto i = 0u; i < size; ++i) {
+                chunk[i] = str[i];
+            }
+            chunk[size] = 0;
+            printf_("%s", chunk);
+            str += size;
+            length -= size;
+        }
         return *this;
     }
 
@@ -95,55 +1001,489 @@ struct printer final {
         !std::is_same<T, const char *>::value,
         printer &
     >::type operator<<(T a) {
-        printf_("0x%x", reinterpret_cast<unsigned long>(a));
-        return *this;
+        char str[2 * sizeof(std::uintptr_t) + 3];
+        auto begin = format_hex(reinterpret_cast<std::uintptr_t>(a), str + sizeof(str));
+        *--begin = 'x';
+        *--begin = '0';
+        return write(begin);
     }
 
     printer &operator<<(std::nullptr_t) {
-        printf_("NULL");
-        return *this;
+        return write("NULL");
     }
 
     printer &operator<<(color c) {
         switch (c) {
             case color::red:
-                printf_("\e[31m");
-                break;
+                return write("\e[31m");
             case color::green:
-                printf_("\e[32m");
-                break;
+                return write("\e[32m");
             case color::reset:
-                printf_("\e[0m");
-                break;
+                return write("\e[0m");
             default:
-                break;
+                return *this;
         }
-        return *this;
     }
 
     printer &operator<<(cursor_movement c) {
         switch (c) {
             case cursor_movement::up:
-                printf_("\033[1A");
-                break;
+                return write("\033[1A");
             default:
-                break;
+                return *this;
         }
-        return *this;
     }
 
 private:
-    printf_t printf_;
+    void append(char c) {
+        buffer_[used_++] = c;
+        if (c == '\n' || used_ == size_ - 1) {
+            flush();
+        }
+    }
+
+    void append(const char *str) {
+        while (*str) {
+            append(*str++);
+        }
+    }
+
+    void append(const char *str, std::size_t length) {
+        for (auto i = 0u; i < length; ++i) {
+            append(str[i]);
+        }
+    }
+
+    // Writes null-terminated digits backwards, ending just before end;
+    // returns pointer to the first digit
+    static char *format_decimal(unsigned long long value, char *end) {
+        *--end = 0;
+        do {
+            *--end = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        return end;
+    }
+
+    static char *format_hex(std::uintptr_t value, char *end) {
+        *--end = 0;
+        do {
+            *--end = "0123456789abcdef"[value & 0xf];
+            value >>= 4;
+        } while (value);
+        return end;
+    }
+
+    // Like printf's "%.<digits>g": up to 17 significant digits, trailing
+    // zeros removed, exponent notation for very small and big values;
+    // negative zero is printed as "0"
+    static void format_float(double value, char *str, int digits = 6) {
+        if (value != value) {
+            copy("nan", str);
+            return;
+        }
+        if (value < 0) {
+            *str++ = '-';
+            value = -value;
+        }
+        if (value - value != 0) {
+            copy("inf", str);
+            return;
+        }
+        if (value == 0) {
+            copy("0", str);
+            return;
+        }
+        digits = digits < 1 ? 1 : digits > 17 ? 17 : digits;
+        char digit_str[18];
+        auto exponent = decimal_digits(value, digit_str, digits);
+        auto significant = digits;
+        while (significant > 1 && digit_str[significant - 1] == '0') {
+            --significant;
+        }
+        auto scientific = exponent < -4 || exponent >= digits;
+        auto point = scientific ? 0 : exponent;
+        if (point < 0) {
+            *str++ = '0';
+            *str++ = '.';
+            for (auto i = point; i < -1; ++i) {
+                *str++ = '0';
+            }
+        }
+        for (auto i = 0; i < significant || i <= point; ++i) {
+            *str++ = digit_str[i];
+            if (i == point && i + 1 < significant) {
+                *str++ = '.';
+            }
+        }
+        if (scientific) {
+            *str++ = 'e';
+            *str++ = exponent < 0 ? '-' : '+';
+            auto abs_exponent = static_cast<unsigned>(exponent < 0 ? -exponent : exponent);
+            if (abs_exponent < 10) {
+                *str++ = '0';
+            }
+            char exponent_digits[4];
+            copy(format_decimal(abs_exponent, exponent_digits + sizeof(exponent_digits)), str);
+            return;
+        }
+        *str = 0;
+    }
+
+    // Writes the first digits of a positive, finite value, rounded half
+    // to even, and returns its decimal exponent. The value is m * 2^e,
+    // which is converted exactly as the integer m * 2^e, or m * 5^-e
+    // (scaled by 10^e) if e is negative
+    static int decimal_digits(double value, char *digit_str, int digits) {
+        auto bits = bit_cast<std::uint64_t>(value);
+        auto biased = static_cast<int>((bits >> 52) & 0x7ff);
+        auto mantissa = bits & ((1ull << 52) - 1);
+        auto exponent = biased ? biased - 1075 : -1074;
+        if (biased) {
+            mantissa |= 1ull << 52;
+        }
+        std::uint32_t limbs[80] = {static_cast<std::uint32_t>(mantissa), static_cast<std::uint32_t>(mantissa >> 32)};
+        auto count = 2u;
+        for (auto e = exponent; e > 0; e -= 31) {
+            multiply(limbs, count, 1u << (e < 31 ? e : 31));
+        }
+        for (auto e = exponent; e < 0; e += 13) {
+            multiply(limbs, count, e > -13 ? power_of_five(-e) : 1220703125u);
+        }
+        // Groups of 9 digits, the least significant first
+        std::uint32_t groups[87];
+        auto group_count = 0;
+        while (count) {
+            groups[group_count++] = divide(limbs, count, 1000000000u);
+        }
+        auto top_digits = 1;
+        for (auto top = groups[group_count - 1]; top >= 10; top /= 10) {
+            ++top_digits;
+        }
+        auto total = top_digits + 9 * (group_count - 1);
+        auto digit_at = [&](int i) {
+            auto position = total - 1 - i;
+            auto group = groups[position / 9];
+            for (auto j = position % 9; j; --j) {
+                group /= 10;
+            }
+            return static_cast<int>(group % 10);
+        };
+        for (auto i = 0; i < digits; ++i) {
+            digit_str[i] = static_cast<char>('0' + (i < total ? digit_at(i) : 0));
+        }
+        digit_str[digits] = 0;
+        auto next = digits < total ? digit_at(digits) : 0;
+        auto sticky = false;
+        for (auto i = digits + 1; i < total && !sticky; ++i) {
+            sticky = digit_at(i) != 0;
+        }
+        exponent = total - 1 + (exponent < 0 ? exponent : 0);
+        if (next > 5 || (next == 5 && (sticky || (digit_str[digits - 1] - '0') % 2))) {
+            auto i = digits - 1;
+            while (i >= 0 && digit_str[i] == '9') {
+                digit_str[i--] = '0';
+            }
+            if (i < 0) {
+                digit_str[0] = '1';
+                ++exponent;
+            }
+            else {
+                ++digit_str[i];
+            }
+        }
+        return exponent;
+    }
+
+    static void multiply(std::uint32_t *limbs, unsigned &count, std::uint32_t factor) {
+        std::uint64_t carry = 0;
+        for (auto i = 0u; i < count; ++i) {
+            carry += static_cast<std::uint64_t>(limbs[i]) * factor;
+            limbs[i] = static_cast<std::uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry) {
+            limbs[count++] = static_cast<std::uint32_t>(carry);
+        }
+    }
+
+    // Returns the remainder; leading zero limbs are dropped
+    static std::uint32_t divide(std::uint32_t *limbs, unsigned &count, std::uint32_t divisor) {
+        std::uint64_t remainder = 0;
+        for (auto i = count; i--;) {
+            remainder = remainder << 32 | limbs[i];
+            limbs[i] = static_cast<std::uint32_t>(remainder / divisor);
+            remainder %= divisor;
+        }
+        while (count && !limbs[count - 1]) {
+            --count;
+        }
+        return static_cast<std::uint32_t>(remainder);
+    }
+
+    static std::uint32_t power_of_five(int exponent) {
+        std::uint32_t result = 1;
+        while (exponent--) {
+            result *= 5;
+        }
+        return result;
+    }
+
+    static void copy(const char *src, char *dest) {
+        while ((*dest++ = *src++));
+    }
+
+    printf_t printf_ = nullptr;
+    char *buffer_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t used_ = 0;
+};
+
+#if YATF_ASYNC_OUTPUT
+
+// Single-producer/single-consumer ring buffer for the session output.
+// The printer passes finished strings to print(), which only copies them;
+// the consumer - a background thread on POSIX systems or the user's idle
+// hook calling yatf::drain_output() - passes them to the real printf.
+// When the ring is full, writes either wait for the consumer (or drain it
+// in place if there's no consumer thread) or are dropped and counted
+struct async_sink final {
+
+    static_assert((YATF_ASYNC_BUFFER_SIZE & (YATF_ASYNC_BUFFER_SIZE - 1)) == 0,
+        "YATF_ASYNC_BUFFER_SIZE must be a power of 2");
+
+    static async_sink &get() {
+        static async_sink instance;
+        return instance;
+    }
+
+    // printf_t for the printer, which only passes "%s" and a string
+    static int print(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto str = va_arg(args, const char *);
+        va_end(args);
+        return static_cast<int>(get().push(str));
+    }
+
+#if YATF_POSIX
+    // stream is the one written by printf, if it's known. It's flushed after
+    // each chunk, so no output waits in stdio buffers when the process
+    // crashes, and output left in the ring is then written out to its file
+    // descriptor by the crash handler (without stream it's lost)
+    void start(printf_t target, overflow_policy policy, bool consumer_thread, std::FILE *stream = nullptr) {
+        target_ = target;
+        policy_ = policy;
+        dropped_ = 0;
+        stream_ = stream;
+        fd_ = stream ? fileno(stream) : -1;
+        set_crash_handlers();
+        if (consumer_thread) {
+            stop_.store(false, std::memory_order_relaxed);
+            consumer_ = std::thread(&async_sink::consume, this);
+        }
+    }
+#else
+    void start(printf_t target, overflow_policy policy, bool consumer_thread) {
+        target_ = target;
+        policy_ = policy;
+        dropped_ = 0;
+        (void)consumer_thread;
+    }
+#endif
+
+    // Passes all buffered output to printf and stops the consumer;
+    // returns number of dropped bytes
+    std::size_t stop() {
+#if YATF_POSIX
+        if (consumer_.joinable()) {
+            stop_.store(true, std::memory_order_release);
+            consumer_.join();
+        }
+        restore_crash_handlers();
+#endif
+        drain_all();
+        target_ = nullptr;
+        return dropped_;
+    }
+
+    // Returns false if there's no target or other consumer is draining
+    bool drain() {
+        if (!target_ || draining_.exchange(true, std::memory_order_acquire)) {
+            return false;
+        }
+        auto tail = tail_.load(std::memory_order_relaxed);
+        for (auto head = head_.load(std::memory_order_acquire); tail != head;
+                head = head_.load(std::memory_order_acquire)) {
+            char chunk[65];
+            auto size = 0u;
+            while (tail != head && size < sizeof(chunk) - 1) {
+                chunk[size++] = data_[tail++ & mask];
+            }
+            chunk[size] = 0;
+            tail_.store(tail, std::memory_order_release);
+            target_("%s", chunk);
+#if YATF_POSIX
+            if (stream_) {
+                std::fflush(stream_);
+            }
+#endif
+        }
+        draining_.store(false, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    enum : std::size_t { mask = YATF_ASYNC_BUFFER_SIZE - 1 };
+
+    std::size_t free_space(std::size_t head) const {
+        return YATF_ASYNC_BUFFER_SIZE - (head - tail_.load(std::memory_order_acquire));
+    }
+
+    std::size_t push(const char *str) {
+        std::size_t length = 0;
+        while (str[length]) {
+            ++length;
+        }
+        auto head = head_.load(std::memory_order_relaxed);
+        if (policy_ == overflow_policy::drop && length > free_space(head)) {
+            dropped_ += length;
+            return 0;
+        }
+        for (auto left = length; left;) {
+            auto space = free_space(head);
+            if (!space) {
+                wait_for_space();
+                continue;
+            }
+            auto size = space < left ? space : left;
+            for (auto i = 0u; i < size; ++i) {
+                data_[head++ & mask] = *str++;
+            }
+            head_.store(head, std::memory_order_release);
+            left -= size;
+        }
+        return length;
+    }
+
+    void wait_for_space() {
+#if YATF_POSIX
+        if (consumer_.joinable()) {
+            std::this_thread::yield();
+            return;
+        }
+#endif
+        drain();
+    }
+
+    // Bounded, so a crash of the consumer itself doesn't hang
+    void drain_all() {
+        for (auto attempts = 0u; !empty() && attempts < 100000; ++attempts) {
+            if (!drain()) {
+#if YATF_POSIX
+                std::this_thread::yield();
+#endif
+            }
+        }
+    }
+
+#if YATF_POSIX
+    void consume() {
+        while (!stop_.load(std::memory_order_acquire)) {
+            drain();
+            if (empty()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+
+    static const int (&crash_signals())[5] {
+        static const int signals[5] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+        return signals;
+    }
+
+    // Output of a test which crashes the process is written out before the
+    // previous handler (e.g. the default one) is run. printf isn't
+    // async-signal-safe (the crash may have happened inside stdio or malloc),
+    // so the rest of the buffer goes to the file descriptor with write();
+    // a chunk being printed by the consumer at the same time may repeat
+    static void crash_handler(int sig) {
+        get().write_out();
+        get().restore_crash_handlers();
+        raise(sig);
+    }
+
+    void write_out() {
+        if (fd_ < 0) {
+            return;
+        }
+        auto tail = tail_.load(std::memory_order_acquire);
+        auto head = head_.load(std::memory_order_acquire);
+        while (tail != head) {
+            auto offset = tail & mask;
+            auto size = head - tail < YATF_ASYNC_BUFFER_SIZE - offset ? head - tail : YATF_ASYNC_BUFFER_SIZE - offset;
+            auto written = ::write(fd_, data_ + offset, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;
+            }
+            tail += static_cast<std::size_t>(written);
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    void set_crash_handlers() {
+        struct sigaction action{};
+        action.sa_handler = &async_sink::crash_handler;
+        sigemptyset(&action.sa_mask);
+        for (auto i = 0u; i < 5; ++i) {
+            sigaction(crash_signals()[i], &action, &old_actions_[i]);
+        }
+    }
+
+    void restore_crash_handlers() {
+        for (auto i = 0u; i < 5; ++i) {
+            sigaction(crash_signals()[i], &old_actions_[i], nullptr);
+        }
+    }
+
+    std::thread consumer_;
+    std::atomic<bool> stop_{false};
+    struct sigaction old_actions_[5];
+    std::FILE *stream_ = nullptr;
+    int fd_ = -1;
+#endif
+
+    char data_[YATF_ASYNC_BUFFER_SIZE];
+    std::atomic<std::size_t> head_{0};
+    std::atomic<std::size_t> tail_{0};
+    std::atomic<bool> draining_{false};
+    printf_t target_ = nullptr;
+    overflow_policy policy_ = overflow_policy::block;
+    std::size_t dropped_ = 0;
 };
 
+#endif
+
 template <typename Type>
 struct list final {
 
     struct node {
 
         ~node() {
+            unlink();
+        }
+
+        void unlink() {
             if (next_ != this) next()->prev() = prev();
             if (prev_ != this) prev()->next() = next();
+            next_ = prev_ = this;
         }
 
         node *&next() {
@@ -249,158 +1589,2984 @@ private:
     std::size_t offset_;
 };
 
-struct test_session final {
+#if YATF_POSIX
+
+struct output_buffer final {
+
+    ~output_buffer() {
+        std::free(data_);
+    }
+
+    void append(const char *fmt, va_list args) {
+        va_list copy;
+        va_copy(copy, args);
+        auto length = std::vsnprintf(nullptr, 0, fmt, copy);
+        va_end(copy);
+        if (length <= 0) {
+            return;
+        }
+        reserve(size_ + static_cast<std::size_t>(length) + 1);
+        std::vsnprintf(data_ + size_, capacity_ - size_, fmt, args);
+        size_ += static_cast<std::size_t>(length);
+    }
+
+    void append(const char *data, std::size_t size) {
+        reserve(size_ + size + 1);
+        std::memcpy(data_ + size_, data, size);
+        size_ += size;
+        data_[size_] = 0;
+    }
+
+    const char *data() const {
+        return data_;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    const char *c_str() const {
+        return data_ ? data_ : "";
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    void clear() {
+        size_ = 0;
+        if (data_) *data_ = 0;
+    }
+
+private:
+    void reserve(std::size_t size) {
+        if (size <= capacity_) {
+            return;
+        }
+        auto new_capacity = capacity_ ? capacity_ : 256;
+        while (new_capacity < size) {
+            new_capacity *= 2;
+        }
+        data_ = static_cast<char *>(std::realloc(data_, new_capacity));
+        capacity_ = new_capacity;
+    }
+
+    char *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
+};
+
+inline output_buffer &thread_output() {
+    static thread_local output_buffer buffer;
+    return buffer;
+}
+
+inline int capture_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    thread_output().append(fmt, args);
+    va_end(args);
+    return 0;
+}
+
+// Isolated tests talk to the parent through a pipe using frames made of
+// a type byte, a 32-bit payload size and the payload itself
+enum class frame : char { output = 'o', result = 'r', binary = 'b' };
+
+inline bool write_all(int fd, const void *data, std::size_t size) {
+    auto ptr = static_cast<const char *>(data);
+    while (size) {
+        auto written = ::write(fd, ptr, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ptr += written;
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+inline void send_frame(int fd, frame type, const void *data, std::uint32_t size) {
+    char header[1 + sizeof(size)];
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &size, sizeof(size));
+    write_all(fd, header, sizeof(header));
+    write_all(fd, data, size);
+}
+
+inline std::uint64_t monotonic_ns() {
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000u + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+inline std::uint64_t monotonic_ms() {
+    return monotonic_ns() / 1000000u;
+}
+
+inline int &isolation_fd() {
+    static int fd = -1;
+    return fd;
+}
+
+inline int isolated_printf(const char *fmt, ...) {
+    auto &output = thread_output();
+    va_list args;
+    va_start(args, fmt);
+    output.append(fmt, args);
+    va_end(args);
+    send_frame(isolation_fd(), frame::output, output.data(), static_cast<std::uint32_t>(output.size()));
+    output.clear();
+    return 0;
+}
+
+// Binary records are passed to config::binary_output by the parent, after
+// the ones of tests which finished before
+inline int isolated_write(const void *data, std::size_t size) {
+    send_frame(isolation_fd(), frame::binary, data, static_cast<std::uint32_t>(size));
+    return static_cast<int>(size);
+}
+
+// Range of test indices owned by one worker; the owner pops from the front
+// and idle workers steal from the back. Both ends live in one word, so
+// a single CAS is enough to claim an index.
+struct work_queue final {
+
+    void assign(std::uint32_t first, std::uint32_t last) {
+        range_.store(pack(first, last));
+    }
+
+    bool pop(std::uint32_t &index) {
+        auto range = range_.load();
+        while (begin(range) < end(range)) {
+            if (range_.compare_exchange_weak(range, pack(begin(range) + 1, end(range)))) {
+                index = begin(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool steal(std::uint32_t &index) {
+        auto range = range_.load();
+        while (begin(range) < end(range)) {
+            if (range_.compare_exchange_weak(range, pack(begin(range), end(range) - 1))) {
+                index = end(range) - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static std::uint64_t pack(std::uint32_t first, std::uint32_t last) {
+        return static_cast<std::uint64_t>(last) << 32 | first;
+    }
+
+    static std::uint32_t begin(std::uint64_t range) {
+        return static_cast<std::uint32_t>(range);
+    }
+
+    static std::uint32_t end(std::uint64_t range) {
+        return static_cast<std::uint32_t>(range >> 32);
+    }
+
+    std::atomic<std::uint64_t> range_{0};
+};
+
+#endif
+
+// Action which has to be done when a test is aborted by a fatal assertion,
+// before its stack is abandoned; unregisters itself when destroyed
+struct cleanup final {
+
+    cleanup(void (*fn)(void *), void *object) : fn_(fn), object_(object) {
+    }
+
+    void run() {
+        node_.unlink();
+        fn_(object_);
+    }
+
+    list<cleanup>::node node_;
+
+private:
+    void (*fn_)(void *);
+    void *object_;
+};
+
+// Failure messages printed by the running test, grouped by call site;
+// messages above the limits are only counted
+struct failure_log final {
+
+    void reset() {
+        count_ = 0;
+        printed_ = 0;
+        other_suppressed_ = 0;
+    }
+
+    bool report(const char *file, int line, std::int32_t id, unsigned max_total, unsigned max_per_site) {
+        auto site = find(file, line, id);
+        if ((max_total && printed_ >= max_total) || (site && max_per_site && site->printed >= max_per_site)) {
+            ++(site ? site->suppressed : other_suppressed_);
+            return false;
+        }
+        ++printed_;
+        if (site) {
+            ++site->printed;
+        }
+        return true;
+    }
+
+    template <typename Function>
+    void for_each_suppressed(Function fn) const {
+        for (auto i = 0u; i < count_; ++i) {
+            if (sites_[i].suppressed) {
+                fn(sites_[i].file, sites_[i].line, sites_[i].id, sites_[i].suppressed);
+            }
+        }
+        if (other_suppressed_) {
+            fn(nullptr, 0, 0, other_suppressed_);
+        }
+    }
+
+private:
+    struct site {
+        const char *file;
+        int line;
+        std::int32_t id;
+        std::size_t printed;
+        std::size_t suppressed;
+    };
+
+    site *find(const char *file, int line, std::int32_t id) {
+        for (auto i = 0u; i < count_; ++i) {
+            if (id ? sites_[i].id == id :
+                    sites_[i].line == line && (sites_[i].file == file || !compare_strings(sites_[i].file, file))) {
+                return &sites_[i];
+            }
+        }
+        if (count_ == YATF_MAX_FAILURE_SITES) {
+            return nullptr;
+        }
+        sites_[count_] = site{file, line, id, 0, 0};
+        return &sites_[count_++];
+    }
+
+    site sites_[YATF_MAX_FAILURE_SITES];
+    unsigned count_ = 0;
+    std::size_t printed_ = 0;
+    std::size_t other_suppressed_ = 0;
+};
+
+struct messages final {
+
+    enum class msg { start_end, run, pass, fail, crash, timeout };
+
+    static const char *get(msg m) {
+        static const char *run_messages_[6] = {"[========]",  "[  RUN   ]", "[  PASS  ]", "[  FAIL  ]", "[ CRASH  ]",
+            "[TIMEOUT ]"};
+        return run_messages_[static_cast<int>(m)];
+    }
+
+};
+
+struct session_report final {
+    std::size_t tests;
+    std::size_t failed;
+    unsigned shard_index;
+    unsigned shard_count;
+};
+
+struct test_report final {
+    const char *suite_name;
+    const char *test_name;
+    std::int32_t site;
+    std::uint32_t hash;
+    std::size_t assertions;
+    std::size_t failed;
+    std::uint64_t duration_ns;
+    bool has_duration;
+};
+
+// Failed assertion; first is a condition, left operand or mock name and
+// second is a right operand. Operands' values are printed with print_lhs
+// and print_rhs if they're known. With YATF_STRIP_STRINGS file and the
+// strings of the expression are null, and only site identifies it
+struct failure_report final {
+    const char *file;
+    int line;
+    std::int32_t site;
+    binary_record::failure_t kind;
+    const char *first;
+    const char *second;
+    const void *lhs;
+    const void *rhs;
+    void (*print_lhs)(printer &, const void *);
+    void (*print_rhs)(printer &, const void *);
+    binary_record values[6];
+    std::uint16_t value_count;
+    // range_*: the first element which differs (or the one with the
+    // maximum error), number of such elements and sizes of both ranges
+    std::uint64_t index;
+    std::uint64_t mismatches;
+    std::uint64_t lhs_size;
+    std::uint64_t rhs_size;
+    // *near, *ulp_equal: the (maximum) error and its limit
+    double error;
+    double tolerance;
+    // bad_call_count, out_of_sequence: calls recorded by the mock, if any
+    const void *calls;
+    void (*print_calls)(printer &, const void *);
+};
+
+// Result of a mock expectation, verified at the end of its scope
+struct call_report final {
+    std::size_t expected;
+    std::size_t actual;
+    bool in_sequence;
+    // Number of the first call out of sequence, 0 if there was none
+    std::uint64_t out_of_sequence;
+    const void *mock;
+    void (*print_calls)(printer &, const void *);
+};
+
+#if YATF_THREAD_SAFE_MOCKS
+
+// Value shared by threads calling a mock; counters are incremented with
+// relaxed ordering, everything else is sequentially consistent. Copies
+// (needed only to return handlers from get_handler()) take the value
+template <typename T>
+struct mock_atomic final {
+
+    mock_atomic(T value = T()) : value_(value) {
+    }
+
+    mock_atomic(const mock_atomic &other) : value_(other.load()) {
+    }
+
+    T load() const {
+        return value_.load();
+    }
+
+    void store(T value) {
+        value_.store(value);
+    }
+
+    T fetch_add(T value) {
+        return value_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    bool compare_exchange(T &expected, T desired) {
+        return value_.compare_exchange_strong(expected, desired);
+    }
+
+private:
+    std::atomic<T> value_;
+};
+
+#else
 
-    struct messages final {
+template <typename T>
+struct mock_atomic final {
+
+    mock_atomic(T value = T()) : value_(value) {
+    }
+
+    T load() const {
+        return value_;
+    }
+
+    void store(T value) {
+        value_ = value;
+    }
+
+    T fetch_add(T value) {
+        auto old = value_;
+        value_ += value;
+        return old;
+    }
+
+    bool compare_exchange(T &expected, T desired) {
+        if (value_ != expected) {
+            expected = value_;
+            return false;
+        }
+        value_ = desired;
+        return true;
+    }
+
+private:
+    T value_;
+};
+
+#endif
+
+// Calls of all mocks in the running test are numbered from 1, so the
+// order of calls of different mocks can be read from their logs; test
+// tells logs of mocks outliving a test that their calls are stale
+struct mock_calls final {
+    mock_atomic<std::uint64_t> test;
+    mock_atomic<std::uint64_t> number;
+};
+
+inline mock_calls &thread_mock_calls() {
+    static YATF_THREAD_LOCAL mock_calls calls;
+    return calls;
+}
+
+#if YATF_THREAD_SAFE_MOCKS
+
+inline std::atomic<mock_calls *> &started_mock_calls() {
+    static std::atomic<mock_calls *> calls{nullptr};
+    return calls;
+}
+
+#endif
+
+// Threads started by a test (which don't run a test themselves) count
+// their calls with the test started last
+inline mock_calls &current_mock_calls() {
+    auto &calls = thread_mock_calls();
+#if YATF_THREAD_SAFE_MOCKS
+    if (!calls.test.load()) {
+        if (auto started = started_mock_calls().load()) {
+            return *started;
+        }
+    }
+#endif
+    return calls;
+}
+
+// Called when a test starts; with thread-safe mocks ids of tests are unique
+// across threads, as other threads may count their calls with any of them
+inline void start_mock_calls() {
+#if YATF_THREAD_SAFE_MOCKS
+    static mock_atomic<std::uint64_t> tests;
+#else
+    static YATF_THREAD_LOCAL mock_atomic<std::uint64_t> tests;
+#endif
+    auto &calls = thread_mock_calls();
+    calls.test.store(tests.fetch_add(1) + 1);
+    calls.number.store(0);
+#if YATF_THREAD_SAFE_MOCKS
+    started_mock_calls().store(&calls);
+#endif
+}
+
+inline void stop_mock_calls() {
+#if YATF_THREAD_SAFE_MOCKS
+    auto calls = &thread_mock_calls();
+    started_mock_calls().compare_exchange_strong(calls, nullptr);
+#endif
+}
+
+template <typename T>
+inline void print_operand(printer &out, const void *value) {
+    out << *static_cast<const T *>(value);
+}
+
+// Elements of a range around its first mismatch
+template <typename T>
+struct range_window final {
+    const T *data;
+    std::size_t begin;
+    std::size_t end;
+};
+
+// Number of elements in the window: 16 bytes of memory comparable
+// elements, which are printed in hex, or only the one which differs
+template <typename T>
+constexpr std::size_t window_size() {
+    return is_memory_comparable<T>::value && sizeof(T) < 16 ? 16 / sizeof(T) : 1;
+}
+
+template <typename T>
+inline range_window<T> make_window(const T *data, std::size_t size, std::size_t index) {
+    auto begin = index > window_size<T>() / 2 ? index - window_size<T>() / 2 : 0;
+    begin = begin < size ? begin : size;
+    auto end = begin + window_size<T>() < size ? begin + window_size<T>() : size;
+    return range_window<T>{data, begin, end};
+}
+
+template <typename T>
+inline void print_element(printer &out, const T &value, std::true_type) {
+    auto bits = static_cast<std::uint64_t>(value);
+    for (auto shift = static_cast<int>(sizeof(T) * 8) - 4; shift >= 0; shift -= 4) {
+        out << "0123456789abcdef"[(bits >> shift) & 0xf];
+    }
+}
+
+template <typename T>
+inline void print_element(printer &out, const T &value, std::false_type) {
+    out << value;
+}
+
+// Prints "[begin] e1 e2 ..."
+template <typename T>
+inline void print_window(printer &out, const void *value) {
+    auto &window = *static_cast<const range_window<T> *>(value);
+    out << '[' << window.begin << ']';
+    for (auto i = window.begin; i < window.end; ++i) {
+        out << ' ';
+        print_element(out, window.data[i], is_memory_comparable<T>());
+    }
+}
+
+// Prints "<lhs> != <rhs>, error <error> > <tolerance>", for ranges
+// prefixed with the number of elements which aren't near and the index
+// of the maximum error
+inline void print_not_near(printer &out, const failure_report &f) {
+    auto range = f.kind == binary_record::range_not_near || f.kind == binary_record::range_not_ulp_equal;
+    auto ulps = f.kind == binary_record::not_ulp_equal || f.kind == binary_record::range_not_ulp_equal;
+    if (range) {
+        if (f.lhs_size != f.rhs_size) {
+            out << "sizes " << f.lhs_size << " != " << f.rhs_size << ", ";
+        }
+        out << f.mismatches << " of " << (f.lhs_size > f.rhs_size ? f.lhs_size : f.rhs_size) << " differ";
+        if (f.index >= f.lhs_size || f.index >= f.rhs_size) {
+            return;
+        }
+        out << ", max error ";
+    }
+    else {
+        if (f.print_lhs) {
+            f.print_lhs(out, f.lhs);
+            out << " != ";
+            f.print_rhs(out, f.rhs);
+            out << ", ";
+        }
+        out << "error ";
+    }
+    auto digits = ulps ? 17 : printer::distinct_digits(f.error, f.tolerance, 17);
+    out << printer::precise{f.error, digits} << " > " << printer::precise{f.tolerance, digits};
+    if (ulps) {
+        out << " ulps";
+    }
+    if (range) {
+        out << " at " << f.index;
+        if (f.print_lhs) {
+            out << ": ";
+            f.print_lhs(out, f.lhs);
+            out << " != ";
+            f.print_rhs(out, f.rhs);
+        }
+    }
+}
+
+// Prints file:line, or "site <id>" if strings are stripped; yatf-decode
+// --text turns the latter back into file:line and the expression
+inline void print_location(printer &out, const char *file, int line, std::int32_t site) {
+    if (file) {
+        out << file << ':' << line;
+    }
+    else {
+        out << "site " << site;
+    }
+}
+
+inline void print_recorded_calls(printer &out, const failure_report &f) {
+    if (f.print_calls) {
+        out << "; ";
+        f.print_calls(out, f.calls);
+    }
+}
+
+// Prints what has failed, without the location
+inline void print_failure(printer &out, const failure_report &f) {
+    switch (f.kind) {
+        case binary_record::is_false:
+            if (f.first) out << '\'' << f.first << "' ";
+            out << "is false";
+            break;
+        case binary_record::is_true:
+            if (f.first) out << '\'' << f.first << "' ";
+            out << "is true";
+            break;
+        case binary_record::not_equal:
+            if (f.first) {
+                out << '\'' << f.first << "' isn't '" << f.second << '\'';
+            }
+            else {
+                out << "not equal";
+            }
+            if (f.print_lhs) {
+                out << ": ";
+                f.print_lhs(out, f.lhs);
+                out << " != ";
+                f.print_rhs(out, f.rhs);
+            }
+            break;
+        case binary_record::bad_call_count:
+            if (f.first) out << f.first;
+            if (f.print_lhs) {
+                if (f.first) out << ": ";
+                out << "expected to be called: ";
+                f.print_lhs(out, f.lhs);
+                out << "; actual: ";
+                f.print_rhs(out, f.rhs);
+            }
+            print_recorded_calls(out, f);
+            break;
+        case binary_record::out_of_sequence:
+            if (f.first) out << f.first << ": ";
+            out << "called out of sequence (call #" << f.index << ')';
+            print_recorded_calls(out, f);
+            break;
+        case binary_record::range_not_equal:
+            if (f.first) {
+                out << '\'' << f.first << "' isn't '" << f.second << '\'';
+            }
+            else {
+                out << "not equal";
+            }
+            out << ": ";
+            if (f.lhs_size != f.rhs_size) {
+                out << "sizes " << f.lhs_size << " != " << f.rhs_size << ", ";
+            }
+            out << f.mismatches << " of " << (f.lhs_size > f.rhs_size ? f.lhs_size : f.rhs_size)
+                << " differ, first at " << f.index;
+            if (f.print_lhs) {
+                out << ": ";
+                f.print_lhs(out, f.lhs);
+                out << " != ";
+                f.print_rhs(out, f.rhs);
+            }
+            break;
+        case binary_record::not_near:
+        case binary_record::not_ulp_equal:
+        case binary_record::range_not_near:
+        case binary_record::range_not_ulp_equal:
+            if (f.first) {
+                out << '\'' << f.first << "' isn't near '" << f.second << '\'';
+            }
+            else {
+                out << "not near";
+            }
+            out << ": ";
+            print_not_near(out, f);
+            break;
+        default:
+            break;
+    }
+}
+
+// Durations are printed in milliseconds with microsecond resolution
+inline void print_duration(printer &out, std::uint64_t ns) {
+    auto us = ns / 1000u;
+    auto fraction = static_cast<unsigned>(us % 1000u);
+    out << static_cast<unsigned>(us / 1000u) << '.';
+    if (fraction < 100) out << '0';
+    if (fraction < 10) out << '0';
+    out << fraction;
+}
+
+inline void print_grouped(printer &out, std::uint64_t value) {
+    if (value >= 1000) {
+        print_grouped(out, value / 1000);
+        auto rest = static_cast<unsigned>(value % 1000);
+        out << ',';
+        if (rest < 100) out << '0';
+        if (rest < 10) out << '0';
+        out << rest;
+        return;
+    }
+    out << static_cast<unsigned>(value);
+}
+
+// Writes str escaped for a JSON string or an XML attribute
+inline void print_escaped(printer &out, const char *str, bool json) {
+    for (; *str; ++str) {
+        auto c = *str;
+        switch (c) {
+            case '"': out << (json ? "\\\"" : "&quot;"); break;
+            case '\\': out << (json ? "\\\\" : "\\"); break;
+            case '\n': out << (json ? "\\n" : "&#10;"); break;
+            case '\t': out << (json ? "\\t" : "&#9;"); break;
+            case '&': out << (json ? "&" : "&amp;"); break;
+            case '<': out << (json ? "<" : "&lt;"); break;
+            case '>': out << (json ? ">" : "&gt;"); break;
+            case '\'': out << (json ? "'" : "&apos;"); break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out << (json ? "\\u00" : "&#x") << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+                    if (!json) out << ';';
+                }
+                else {
+                    out << c;
+                }
+                break;
+        }
+    }
+}
+
+inline printer *&escape_target() {
+    static YATF_THREAD_LOCAL printer *target = nullptr;
+    return target;
+}
+
+template <bool Json>
+inline int escaping_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    auto str = va_arg(args, const char *);
+    va_end(args);
+    print_escaped(*escape_target(), str, Json);
+    return 0;
+}
+
+// Prints failure message escaped (values of operands included)
+template <bool Json>
+inline void print_escaped_failure(printer &out, const failure_report &f) {
+    printer escaping;
+    escaping.initialize(&escaping_printf<Json>);
+    escape_target() = &out;
+    print_failure(escaping, f);
+    escape_target() = nullptr;
+}
+
+// Reporters receive events of the session and write them to the given
+// printer; all of them have the same set of (non-virtual) functions, so
+// the session can be built with any of them (see YATF_REPORTER). Events
+// of a single test come from the thread running it (or from its child
+// process), so per-test state has to be thread-local. prints_values
+// and sends_values tell whether operands of failed assertions are
+// printed or sent as binary_records, so unused formatting is left out
+struct text_reporter final {
+
+    static constexpr bool prints_values = true;
+    static constexpr bool sends_values = false;
+
+    void select(const config &c) {
+        configure(c.color, c.oneliners, c.fails_only);
+    }
+
+    void configure(bool color, bool oneliners, bool fails_only) {
+        color_ = color;
+        oneliners_ = oneliners;
+        fails_only_ = fails_only;
+    }
+
+    void session_start(printer &out, const session_report &s) {
+        print_in_color(out, messages::msg::start_end, printer::color::green);
+        out << " Running " << static_cast<int>(s.tests) << " test cases";
+        shard_message(out, s);
+        out << "\n";
+    }
+
+    void test_start(printer &out, const test_report &t) {
+        if (fails_only_) return;
+        print_in_color(out, messages::msg::run, printer::color::green);
+        out << " " << t.suite_name << "." << t.test_name << "\n";
+    }
+
+    void failure(printer &out, const test_report &, const failure_report &f) {
+        out << "assertion failed: ";
+        print_location(out, f.file, f.line, f.site);
+        out << ' ';
+        print_failure(out, f);
+        out << "\n";
+    }
+
+    void suppressed(printer &out, const test_report &, const char *file, int line, std::int32_t site,
+            std::uint64_t count) {
+        out << "... ";
+        print_grouped(out, count);
+        if (file || site) {
+            out << " more failures at ";
+            print_location(out, file, line, site);
+            out << "\n";
+        }
+        else {
+            out << " more failures at other locations\n";
+        }
+    }
+
+    void test_end(printer &out, const test_report &t) {
+        if (t.failed) {
+            print_in_color(out, messages::msg::fail, printer::color::red);
+            result_line(out, t);
+        }
+        else {
+            if (fails_only_) return;
+            if (oneliners_)
+                out << printer::cursor_movement::up;
+            print_in_color(out, messages::msg::pass, printer::color::green);
+            result_line(out, t);
+        }
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) {
+        print_in_color(out, messages::msg::crash, printer::color::red);
+        out << " " << t.suite_name << "." << t.test_name;
+        if (signal) {
+            out << " (signal " << signal;
+#if YATF_POSIX
+            out << ": " << ::strsignal(signal);
+#endif
+            out << ")\n";
+        }
+        else {
+            out << " (exit code " << exit_code << ")\n";
+        }
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) {
+        print_in_color(out, messages::msg::timeout, printer::color::red);
+        out << " " << t.suite_name << "." << t.test_name << " (exceeded " << timeout_ms << " ms)\n";
+    }
+
+    void session_end(printer &out, const session_report &s) {
+        if (fails_only_ && oneliners_)
+            out << printer::cursor_movement::up;
+        print_in_color(out, messages::msg::start_end, printer::color::green);
+        out << " Passed " << static_cast<int>(s.tests - s.failed) << " test cases";
+        shard_message(out, s);
+        out << "\n";
+        if (s.failed) {
+            print_in_color(out, messages::msg::start_end, printer::color::red);
+            out << " Failed " << static_cast<int>(s.failed) << " test cases";
+            shard_message(out, s);
+            out << "\n";
+        }
+    }
+
+private:
+    void print_in_color(printer &out, messages::msg m, printer::color color) const {
+        if (color_) out << color;
+        out << messages::get(m);
+        if (color_) out << printer::color::reset;
+    }
+
+    static void shard_message(printer &out, const session_report &s) {
+        if (s.shard_count > 1) {
+            out << " (shard " << s.shard_index << " of " << s.shard_count << ")";
+        }
+    }
+
+    static void result_line(printer &out, const test_report &t) {
+        out << " " << t.suite_name << "." << t.test_name << " (" << static_cast<int>(t.assertions) << " assertions";
+        if (t.has_duration) {
+            out << ", ";
+            print_duration(out, t.duration_ns);
+            out << " ms";
+        }
+        out << ")\n";
+    }
+
+    bool color_ = true;
+    bool oneliners_ = false;
+    bool fails_only_ = false;
+};
+
+// JUnit XML with all tests in a single testsuite; a testcase is written
+// when the test ends, with the first failure's message kept until then
+struct junit_reporter final {
+
+    static constexpr bool prints_values = true;
+    static constexpr bool sends_values = false;
+
+    void select(const config &) {
+    }
+
+    void session_start(printer &out, const session_report &s) {
+        out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        out << "<testsuite name=\"yatf\" tests=\"" << s.tests << "\">\n";
+    }
+
+    void test_start(printer &, const test_report &) {
+        current().has_failure = false;
+    }
+
+    void failure(printer &, const test_report &, const failure_report &f) {
+        auto &state = current();
+        if (state.has_failure) {
+            return;
+        }
+        state.has_failure = true;
+        printer message;
+        message.initialize(&message_printf);
+        message_target() = &state;
+        state.length = 0;
+        if (f.file) {
+            print_escaped(message, f.file, false);
+            message << ':' << f.line << ' ';
+        }
+        else {
+            message << "site " << f.site << ' ';
+        }
+        print_escaped_failure<false>(message, f);
+        message_target() = nullptr;
+    }
+
+    void suppressed(printer &, const test_report &, const char *, int, std::int32_t, std::uint64_t) {
+    }
+
+    void test_end(printer &out, const test_report &t) {
+        testcase_start(out, t);
+        if (t.failed) {
+            auto &state = current();
+            out << ">\n    <failure message=\"" << (state.has_failure ? state.message : "") << "\" type=\"assertion\">"
+                << t.failed << " of " << t.assertions << " assertions failed</failure>\n  </testcase>\n";
+        }
+        else {
+            out << "/>\n";
+        }
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) {
+        testcase_start(out, t);
+        out << ">\n    <error message=\"";
+        if (signal) {
+            out << "signal " << signal;
+        }
+        else {
+            out << "exit code " << exit_code;
+        }
+        out << "\" type=\"crash\"/>\n  </testcase>\n";
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) {
+        testcase_start(out, t);
+        out << ">\n    <error message=\"exceeded " << timeout_ms << " ms\" type=\"timeout\"/>\n  </testcase>\n";
+    }
+
+    void session_end(printer &out, const session_report &) {
+        out << "</testsuite>\n";
+    }
+
+private:
+    enum { message_size = 256 };
+
+    struct test_state final {
+        bool has_failure;
+        std::size_t length;
+        char message[message_size];
+    };
+
+    static test_state &current() {
+        static YATF_THREAD_LOCAL test_state state;
+        return state;
+    }
+
+    static test_state *&message_target() {
+        static YATF_THREAD_LOCAL test_state *target = nullptr;
+        return target;
+    }
+
+    // Keeps the message truncated to message_size - 1 characters
+    static int message_printf(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto str = va_arg(args, const char *);
+        va_end(args);
+        auto &state = *message_target();
+        while (*str && state.length < message_size - 1) {
+            state.message[state.length++] = *str++;
+        }
+        state.message[state.length] = 0;
+        return 0;
+    }
+
+    static void testcase_start(printer &out, const test_report &t) {
+        out << "  <testcase classname=\"";
+        print_escaped(out, t.suite_name, false);
+        out << "\" name=\"";
+        print_escaped(out, t.test_name, false);
+        out << "\"";
+        if (t.has_duration) {
+            out << " time=\"" << static_cast<unsigned>(t.duration_ns / 1000000000u) << '.';
+            auto us = static_cast<unsigned>(t.duration_ns / 1000u % 1000000u);
+            for (auto digit = 100000u; digit > 1 && us < digit; digit /= 10) {
+                out << '0';
+            }
+            out << us << "\"";
+        }
+    }
+};
+
+// One JSON object per line for every event
+struct json_reporter final {
+
+    static constexpr bool prints_values = true;
+    static constexpr bool sends_values = false;
+
+    void select(const config &) {
+    }
+
+    void session_start(printer &out, const session_report &s) {
+        out << "{\"event\":\"session_start\",\"tests\":" << s.tests;
+        shard(out, s);
+        out << "}\n";
+    }
+
+    void test_start(printer &out, const test_report &t) {
+        event(out, "test_start", t);
+        out << "}\n";
+    }
+
+    void failure(printer &out, const test_report &t, const failure_report &f) {
+        event(out, "failure", t);
+        location(out, f.file, f.line, f.site);
+        out << ",\"message\":\"";
+        print_escaped_failure<true>(out, f);
+        out << "\"}\n";
+    }
+
+    void suppressed(printer &out, const test_report &t, const char *file, int line, std::int32_t site,
+            std::uint64_t count) {
+        event(out, "suppressed", t);
+        if (file || site) {
+            location(out, file, line, site);
+        }
+        out << ",\"count\":" << count << "}\n";
+    }
+
+    void test_end(printer &out, const test_report &t) {
+        test_end(out, t, t.failed ? "fail" : "pass");
+        out << "}\n";
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) {
+        test_end(out, t, "crash");
+        if (signal) {
+            out << ",\"signal\":" << signal << "}\n";
+        }
+        else {
+            out << ",\"exit_code\":" << exit_code << "}\n";
+        }
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) {
+        test_end(out, t, "timeout");
+        out << ",\"timeout_ms\":" << timeout_ms << "}\n";
+    }
+
+    void session_end(printer &out, const session_report &s) {
+        out << "{\"event\":\"session_end\",\"passed\":" << s.tests - s.failed << ",\"failed\":" << s.failed;
+        shard(out, s);
+        out << "}\n";
+    }
+
+private:
+    static void event(printer &out, const char *name, const test_report &t) {
+        out << "{\"event\":\"" << name << "\",\"suite\":\"";
+        print_escaped(out, t.suite_name, true);
+        out << "\",\"name\":\"";
+        print_escaped(out, t.test_name, true);
+        out << "\"";
+    }
+
+    static void location(printer &out, const char *file, int line, std::int32_t site) {
+        if (file) {
+            out << ",\"file\":\"";
+            print_escaped(out, file, true);
+            out << "\",\"line\":" << line;
+        }
+        else {
+            out << ",\"site\":" << site;
+        }
+    }
+
+    static void test_end(printer &out, const test_report &t, const char *result) {
+        event(out, "test_end", t);
+        out << ",\"result\":\"" << result << "\",\"assertions\":" << t.assertions << ",\"failed\":" << t.failed;
+        if (t.has_duration) {
+            out << ",\"duration_ms\":";
+            print_duration(out, t.duration_ns);
+        }
+    }
+
+    static void shard(printer &out, const session_report &s) {
+        if (s.shard_count > 1) {
+            out << ",\"shard_index\":" << s.shard_index << ",\"shard_count\":" << s.shard_count;
+        }
+    }
+};
+
+// TAP version 13; tests are numbered implicitly, as in parallel runs they
+// end out of order, and failures are written as diagnostics following
+// the test point
+struct tap_reporter final {
+
+    static constexpr bool prints_values = true;
+    static constexpr bool sends_values = false;
+
+    void select(const config &) {
+    }
+
+    void session_start(printer &out, const session_report &s) {
+        out << "TAP version 13\n1.." << s.tests << "\n";
+    }
+
+    void test_start(printer &, const test_report &) {
+        current().length = 0;
+        current().truncated = false;
+    }
+
+    void failure(printer &, const test_report &, const failure_report &f) {
+        printer out;
+        out.initialize(&diagnostics_printf);
+        out << "# assertion failed: ";
+        print_location(out, f.file, f.line, f.site);
+        out << ' ';
+        print_failure(out, f);
+        out << "\n";
+    }
+
+    void suppressed(printer &, const test_report &, const char *file, int line, std::int32_t site,
+            std::uint64_t count) {
+        printer out;
+        out.initialize(&diagnostics_printf);
+        out << "# ... ";
+        print_grouped(out, count);
+        if (file || site) {
+            out << " more failures at ";
+            print_location(out, file, line, site);
+            out << "\n";
+        }
+        else {
+            out << " more failures at other locations\n";
+        }
+    }
+
+    void test_end(printer &out, const test_report &t) {
+        out << (t.failed ? "not ok - " : "ok - ") << t.suite_name << "." << t.test_name << "\n";
+        print_diagnostics(out);
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) {
+        out << "not ok - " << t.suite_name << "." << t.test_name;
+        if (signal) {
+            out << " # crashed with signal " << signal << "\n";
+        }
+        else {
+            out << " # crashed with exit code " << exit_code << "\n";
+        }
+        print_diagnostics(out);
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) {
+        out << "not ok - " << t.suite_name << "." << t.test_name << " # exceeded " << timeout_ms << " ms\n";
+        print_diagnostics(out);
+    }
+
+    void session_end(printer &, const session_report &) {
+    }
+
+private:
+    enum { diagnostics_size = 1024 };
+
+    // Diagnostic lines of a test are kept until its "ok"/"not ok" line is
+    // printed, as TAP consumers attach them to the test point before them
+    struct test_state final {
+        std::size_t length;
+        bool truncated;
+        char text[diagnostics_size];
+    };
+
+    static test_state &current() {
+        static YATF_THREAD_LOCAL test_state state;
+        return state;
+    }
+
+    // Keeps the lines which fit in diagnostics_size - 1 characters
+    static int diagnostics_printf(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto str = va_arg(args, const char *);
+        va_end(args);
+        auto &state = current();
+        if (state.truncated) {
+            return 0;
+        }
+        while (*str && state.length < diagnostics_size - 1) {
+            state.text[state.length++] = *str++;
+        }
+        if (*str) {
+            state.truncated = true;
+            while (state.length && state.text[state.length - 1] != '\n') {
+                --state.length;
+            }
+        }
+        state.text[state.length] = 0;
+        return 0;
+    }
+
+    static void print_diagnostics(printer &out) {
+        auto &state = current();
+        state.text[state.length] = 0;
+        out << state.text;
+        if (state.truncated) {
+            out << "# ... more diagnostics truncated\n";
+        }
+        state.length = 0;
+        state.truncated = false;
+    }
+};
+
+// Sends binary_records to the write function instead of printing; tests
+// are run serially, so records of a test run in a child process (with
+// --isolate or a timeout) are followed by its crash or timeout
+struct binary_reporter final {
+
+    static constexpr bool prints_values = false;
+    static constexpr bool sends_values = true;
+
+    void select(const config &c) {
+        initialize(c.binary_output);
+    }
+
+    void initialize(write_t write) {
+        write_ = write;
+    }
+
+    void session_start(printer &, const session_report &s) {
+        send(binary_record{binary_record::session_start, 0, 0, 0, s.tests});
+    }
+
+    void test_start(printer &, const test_report &t) {
+        send(binary_record{binary_record::test_start, 0, 0, t.site, t.hash});
+    }
+
+    void failure(printer &, const test_report &, const failure_report &f) {
+        send(binary_record{binary_record::failure, f.kind, f.value_count, f.site, 0});
+        for (auto i = 0u; i < f.value_count; ++i) {
+            send(f.values[i]);
+        }
+    }
+
+    void suppressed(printer &, const test_report &, const char *, int, std::int32_t site,
+            std::uint64_t count) {
+        send(binary_record{binary_record::suppressed, 0, 0, site, count});
+    }
+
+    void test_end(printer &, const test_report &t) {
+        send_duration(t);
+        send(binary_record{binary_record::test_end, 0, 0, t.site,
+            t.assertions | static_cast<std::uint64_t>(t.failed) << 32});
+    }
+
+    void test_crash(printer &, const test_report &t, int signal, int exit_code) {
+        send_duration(t);
+        send(binary_record{binary_record::test_crash, static_cast<std::uint8_t>(signal), 0, t.site,
+            static_cast<std::uint64_t>(static_cast<std::int64_t>(exit_code))});
+    }
+
+    void test_timeout(printer &, const test_report &t, unsigned timeout_ms) {
+        send_duration(t);
+        send(binary_record{binary_record::test_timeout, 0, 0, t.site, timeout_ms});
+    }
+
+    void session_end(printer &, const session_report &s) {
+        send(binary_record{binary_record::session_end, 0, 0, 0, s.failed});
+    }
+
+private:
+    void send_duration(const test_report &t) {
+        if (t.has_duration) {
+            send(binary_record{binary_record::duration, 0, 0, t.site, t.duration_ns});
+        }
+    }
+
+    void send(const binary_record &record) {
+        if (write_) {
+            write_(&record, sizeof(record));
+        }
+    }
+
+    write_t write_ = nullptr;
+};
+
+// Reports nothing; the session still returns the number of failed tests
+struct silent_reporter final {
+
+    static constexpr bool prints_values = false;
+    static constexpr bool sends_values = false;
+
+    void select(const config &) {
+    }
+
+    void session_start(printer &, const session_report &) {
+    }
+
+    void test_start(printer &, const test_report &) {
+    }
+
+    void failure(printer &, const test_report &, const failure_report &) {
+    }
+
+    void suppressed(printer &, const test_report &, const char *, int, std::int32_t, std::uint64_t) {
+    }
+
+    void test_end(printer &, const test_report &) {
+    }
+
+    void test_crash(printer &, const test_report &, int, int) {
+    }
+
+    void test_timeout(printer &, const test_report &, unsigned) {
+    }
+
+    void session_end(printer &, const session_report &) {
+    }
+};
+
+// Interface for reporters selected at run time
+struct reporter {
+    virtual void session_start(printer &out, const session_report &s) = 0;
+    virtual void test_start(printer &out, const test_report &t) = 0;
+    virtual void failure(printer &out, const test_report &t, const failure_report &f) = 0;
+    // file is null for failures at other locations
+    virtual void suppressed(printer &out, const test_report &t, const char *file, int line, std::int32_t site,
+        std::uint64_t count) = 0;
+    virtual void test_end(printer &out, const test_report &t) = 0;
+    // Test run in a child process; signal is 0 if it exited with exit_code
+    virtual void test_crash(printer &out, const test_report &t, int signal, int exit_code) = 0;
+    virtual void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) = 0;
+    virtual void session_end(printer &out, const session_report &s) = 0;
+
+protected:
+    ~reporter() {}
+};
+
+template <typename Impl>
+struct dynamic_reporter final : reporter {
+
+    Impl &get() {
+        return impl_;
+    }
+
+    void session_start(printer &out, const session_report &s) override {
+        impl_.session_start(out, s);
+    }
+
+    void test_start(printer &out, const test_report &t) override {
+        impl_.test_start(out, t);
+    }
+
+    void failure(printer &out, const test_report &t, const failure_report &f) override {
+        impl_.failure(out, t, f);
+    }
+
+    void suppressed(printer &out, const test_report &t, const char *file, int line, std::int32_t site,
+            std::uint64_t count) override {
+        impl_.suppressed(out, t, file, line, site, count);
+    }
+
+    void test_end(printer &out, const test_report &t) override {
+        impl_.test_end(out, t);
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) override {
+        impl_.test_crash(out, t, signal, exit_code);
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) override {
+        impl_.test_timeout(out, t, timeout_ms);
+    }
+
+    void session_end(printer &out, const session_report &s) override {
+        impl_.session_end(out, s);
+    }
+
+private:
+    Impl impl_;
+};
+
+// Any of the reporters chosen by config::reporter, or the binary one if
+// config::binary_output is set
+struct selectable_reporter final {
+
+    static constexpr bool prints_values = true;
+    static constexpr bool sends_values = true;
+
+    void select(const config &c) {
+        if (c.binary_output) {
+            binary_.get().select(c);
+            current_ = &binary_;
+            return;
+        }
+        switch (c.reporter) {
+            case reporter_type::junit: current_ = &junit_; return;
+            case reporter_type::json: current_ = &json_; return;
+            case reporter_type::tap: current_ = &tap_; return;
+            default: break;
+        }
+        text_.get().select(c);
+        current_ = &text_;
+    }
+
+    bool text() const {
+        return current_ == &text_;
+    }
+
+    void session_start(printer &out, const session_report &s) {
+        current_->session_start(out, s);
+    }
+
+    void test_start(printer &out, const test_report &t) {
+        current_->test_start(out, t);
+    }
+
+    void failure(printer &out, const test_report &t, const failure_report &f) {
+        current_->failure(out, t, f);
+    }
+
+    void suppressed(printer &out, const test_report &t, const char *file, int line, std::int32_t site,
+            std::uint64_t count) {
+        current_->suppressed(out, t, file, line, site, count);
+    }
+
+    void test_end(printer &out, const test_report &t) {
+        current_->test_end(out, t);
+    }
+
+    void test_crash(printer &out, const test_report &t, int signal, int exit_code) {
+        current_->test_crash(out, t, signal, exit_code);
+    }
+
+    void test_timeout(printer &out, const test_report &t, unsigned timeout_ms) {
+        current_->test_timeout(out, t, timeout_ms);
+    }
+
+    void session_end(printer &out, const session_report &s) {
+        current_->session_end(out, s);
+    }
+
+private:
+    dynamic_reporter<text_reporter> text_;
+    dynamic_reporter<junit_reporter> junit_;
+    dynamic_reporter<json_reporter> json_;
+    dynamic_reporter<tap_reporter> tap_;
+    dynamic_reporter<binary_reporter> binary_;
+    reporter *current_ = &text_;
+};
+
+#if YATF_REPORTER == YATF_REPORTER_TEXT
+using session_reporter = text_reporter;
+#elif YATF_REPORTER == YATF_REPORTER_BINARY
+using session_reporter = binary_reporter;
+#elif YATF_REPORTER == YATF_REPORTER_SILENT
+using session_reporter = silent_reporter;
+#else
+using session_reporter = selectable_reporter;
+#endif
+
+inline clock_func_t default_clock() {
+#if YATF_POSIX
+    return monotonic_ns;
+#else
+    return nullptr;
+#endif
+}
+
+#if YATF_POSIX
+
+// Failure of an assertion made in a thread started by a test. It's
+// reported by the thread running the test once the test body returns, so
+// strings and values it refers to are copied as text
+struct helper_failure final {
+    enum { text_size = 256 };
+    failure_report report;
+    helper_failure *next;
+    char texts[5][text_size];
+};
+
+#endif
+
+struct test_session final {
+
+    using messages = detail::messages;
+
+    struct test_case {
+
+        bool require_true(bool condition, const char *condition_str, const char *file, int line,
+                std::int32_t site = 0) {
+            ++assertions_;
+            if (YATF_UNLIKELY(!condition)) {
+                fail(binary_record::is_false, file, line, site, condition_str);
+            }
+            return condition;
+        }
+
+        bool require_false(bool condition, const char *condition_str, const char *file, int line,
+                std::int32_t site = 0) {
+            ++assertions_;
+            if (YATF_UNLIKELY(condition)) {
+                fail(binary_record::is_true, file, line, site, condition_str);
+            }
+            return !condition;
+        }
+
+        template <typename T1, typename T2>
+        bool require_eq(const T1 &lhs, const T2 &rhs, const char *lhs_str, const char *rhs_str,
+                const char *file, int line, std::int32_t site = 0) {
+            ++assertions_;
+            bool cond = (lhs == rhs);
+            if (YATF_UNLIKELY(!cond)) {
+                fail(binary_record::not_equal, file, line, site, lhs_str, rhs_str, lhs, rhs);
+            }
+            return cond;
+        }
+
+        bool require_eq(const char *lhs, const char *rhs, const char *, const char *, const char *file, int line,
+                std::int32_t site = 0) {
+            ++assertions_;
+            bool cond = compare_strings(lhs, rhs) == 0;
+            if (YATF_UNLIKELY(!cond)) {
+                fail(binary_record::not_equal, file, line, site, lhs, rhs);
+            }
+            return cond;
+        }
+
+        // Number of calls and, for expectations in a sequence, their order
+        // are separate assertions
+        void require_call(const char *mock_name, const call_report &report, const char *file, int line,
+                std::int32_t site = 0) {
+            ++assertions_;
+            if (YATF_UNLIKELY(report.expected != report.actual)) {
+                fail_call(binary_record::bad_call_count, file, line, site, mock_name, report);
+            }
+            if (report.in_sequence) {
+                ++assertions_;
+                if (YATF_UNLIKELY(report.out_of_sequence)) {
+                    fail_call(binary_record::out_of_sequence, file, line, site, mock_name, report);
+                }
+            }
+        }
+
+        // Compares contiguous ranges (arrays or containers with data() and
+        // size()) as one assertion; integral elements are compared as memory
+        template <typename R1, typename R2>
+        bool require_range_eq(const R1 &lhs, const R2 &rhs, const char *lhs_str, const char *rhs_str,
+                const char *file, int line, std::int32_t site = 0) {
+            ++assertions_;
+            auto lhs_data = range_data(lhs);
+            auto rhs_data = range_data(rhs);
+            auto lhs_size = range_size(lhs);
+            auto rhs_size = range_size(rhs);
+            bool cond = lhs_size == rhs_size && find_mismatch(lhs_data, rhs_data, lhs_size) == lhs_size;
+            if (YATF_UNLIKELY(!cond)) {
+                fail_range(file, line, site, lhs_str, rhs_str, lhs_data, lhs_size, rhs_data, rhs_size);
+            }
+            return cond;
+        }
+
+        bool require_mem_eq(const void *lhs, const void *rhs, std::size_t size, const char *lhs_str,
+                const char *rhs_str, const char *file, int line, std::int32_t site = 0) {
+            ++assertions_;
+            auto lhs_data = static_cast<const unsigned char *>(lhs);
+            auto rhs_data = static_cast<const unsigned char *>(rhs);
+            bool cond = find_byte_mismatch(lhs_data, rhs_data, size) == size;
+            if (YATF_UNLIKELY(!cond)) {
+                fail_range(file, line, site, lhs_str, rhs_str, lhs_data, size, rhs_data, size);
+            }
+            return cond;
+        }
+
+        template <typename T1, typename T2, typename T3>
+        bool require_near(const T1 &lhs, const T2 &rhs, const T3 &tolerance, const char *lhs_str,
+                const char *rhs_str, const char *file, int line, std::int32_t site = 0) {
+            static_assert(std::is_arithmetic<T1>::value && std::is_arithmetic<T2>::value,
+                "REQUIRE_NEAR compares numbers");
+            ++assertions_;
+            bool cond = is_near(lhs, rhs, tolerance);
+            if (YATF_UNLIKELY(!cond)) {
+                fail_near(binary_record::not_near, file, line, site, lhs_str, rhs_str, lhs, rhs,
+                    near_error(lhs, rhs), static_cast<double>(tolerance));
+            }
+            return cond;
+        }
+
+        template <typename T1, typename T2>
+        bool require_ulp_eq(const T1 &lhs, const T2 &rhs, std::uint64_t max_ulps, const char *lhs_str,
+                const char *rhs_str, const char *file, int line, std::int32_t site = 0) {
+            static_assert(std::is_same<T1, T2>::value, "REQUIRE_ULP_EQ compares values of the same type");
+            ++assertions_;
+            bool cond = ulp_distance(lhs, rhs) <= max_ulps;
+            if (YATF_UNLIKELY(!cond)) {
+                fail_near(binary_record::not_ulp_equal, file, line, site, lhs_str, rhs_str, lhs, rhs,
+                    ulp_error(lhs, rhs), static_cast<double>(max_ulps));
+            }
+            return cond;
+        }
+
+        // Elements are compared in the type of their sum, float arrays with
+        // SSE2 or AVX2; on failure the whole ranges are checked to find
+        // the maximum error
+        template <typename R1, typename R2, typename T>
+        bool require_range_near(const R1 &lhs, const R2 &rhs, const T &tolerance, const char *lhs_str,
+                const char *rhs_str, const char *file, int line, std::int32_t site = 0) {
+            ++assertions_;
+            auto lhs_data = range_data(lhs);
+            auto rhs_data = range_data(rhs);
+            auto lhs_size = range_size(lhs);
+            auto rhs_size = range_size(rhs);
+            using value_t = decltype(*lhs_data + *rhs_data);
+            auto check = near_check<value_t>{static_cast<value_t>(tolerance)};
+            bool cond = lhs_size == rhs_size && find_not_near(lhs_data, rhs_data, lhs_size, check.tolerance) == lhs_size;
+            if (YATF_UNLIKELY(!cond)) {
+                fail_range_near(binary_record::range_not_near, file, line, site, lhs_str, rhs_str, lhs_data,
+                    lhs_size, rhs_data, rhs_size, check);
+            }
+            return cond;
+        }
+
+        template <typename R1, typename R2>
+        bool require_range_ulp_eq(const R1 &lhs, const R2 &rhs, std::uint64_t max_ulps, const char *lhs_str,
+                const char *rhs_str, const char *file, int line, std::int32_t site = 0) {
+            ++assertions_;
+            auto lhs_data = range_data(lhs);
+            auto rhs_data = range_data(rhs);
+            auto lhs_size = range_size(lhs);
+            auto rhs_size = range_size(rhs);
+            static_assert(std::is_same<decltype(lhs_data), decltype(rhs_data)>::value,
+                "REQUIRE_RANGE_ULP_EQ compares ranges of the same type");
+            bool cond = lhs_size == rhs_size && find_not_ulp_equal(lhs_data, rhs_data, lhs_size, max_ulps) == lhs_size;
+            if (YATF_UNLIKELY(!cond)) {
+                fail_range_near(binary_record::range_not_ulp_equal, file, line, site, lhs_str, rhs_str, lhs_data,
+                    lhs_size, rhs_data, rhs_size, ulp_check{max_ulps});
+            }
+            return cond;
+        }
+
+        YATF_COLD void fail(binary_record::failure_t kind, const char *file, int line, std::int32_t site,
+                const char *first, const char *second = "") {
+            ++failed_;
+            if (report_failure(file, line, site)) {
+                failure(make_failure(kind, file, line, site, first, second));
+            }
+        }
+
+        template <typename T1, typename T2>
+        YATF_COLD void fail(binary_record::failure_t kind, const char *file, int line, std::int32_t site,
+                const char *first, const char *second, const T1 &lhs, const T2 &rhs) {
+            ++failed_;
+            if (report_failure(file, line, site)) {
+                failure(make_failure(kind, file, line, site, first, second), lhs, rhs);
+            }
+        }
+
+        template <typename T1, typename T2>
+        YATF_COLD void fail_range(const char *file, int line, std::int32_t site, const char *first,
+                const char *second, const T1 *lhs, std::size_t lhs_size, const T2 *rhs, std::size_t rhs_size) {
+            ++failed_;
+            if (!report_failure(file, line, site)) {
+                return;
+            }
+            auto size = lhs_size < rhs_size ? lhs_size : rhs_size;
+            auto f = make_failure(binary_record::range_not_equal, file, line, site, first, second);
+            f.index = find_mismatch(lhs, rhs, size);
+            f.mismatches = count_mismatches(lhs + f.index, rhs + f.index, size - f.index) +
+                (lhs_size - size) + (rhs_size - size);
+            f.lhs_size = lhs_size;
+            f.rhs_size = rhs_size;
+            auto lhs_window = make_window(lhs, lhs_size, static_cast<std::size_t>(f.index));
+            auto rhs_window = make_window(rhs, rhs_size, static_cast<std::size_t>(f.index));
+            print_windows(f, lhs_window, rhs_window, std::integral_constant<bool, session_reporter::prints_values>());
+            send_range(f, std::integral_constant<bool, session_reporter::sends_values>());
+            failure(f);
+        }
+
+        template <typename T1, typename T2>
+        YATF_COLD void fail_near(binary_record::failure_t kind, const char *file, int line, std::int32_t site,
+                const char *first, const char *second, const T1 &lhs, const T2 &rhs, double error, double tolerance) {
+            ++failed_;
+            if (!report_failure(file, line, site)) {
+                return;
+            }
+            auto f = make_failure(kind, file, line, site, first, second);
+            f.error = error;
+            f.tolerance = tolerance;
+            auto digits = printer::distinct_digits(static_cast<double>(lhs), static_cast<double>(rhs),
+                max_digits<T1>() > max_digits<T2>() ? max_digits<T1>() : max_digits<T2>());
+            printer::precise lhs_value{static_cast<double>(lhs), digits};
+            printer::precise rhs_value{static_cast<double>(rhs), digits};
+            print_values(f, lhs_value, rhs_value, std::integral_constant<bool, session_reporter::prints_values>());
+            send_near(f, lhs, rhs, std::integral_constant<bool, session_reporter::sends_values>());
+            failure(f);
+        }
+
+        template <typename T1, typename T2, typename Check>
+        YATF_COLD void fail_range_near(binary_record::failure_t kind, const char *file, int line, std::int32_t site,
+                const char *first, const char *second, const T1 *lhs, std::size_t lhs_size, const T2 *rhs,
+                std::size_t rhs_size, const Check &check) {
+            ++failed_;
+            if (!report_failure(file, line, site)) {
+                return;
+            }
+            auto size = lhs_size < rhs_size ? lhs_size : rhs_size;
+            auto f = make_failure(kind, file, line, site, first, second);
+            f.index = size;
+            f.mismatches = (lhs_size - size) + (rhs_size - size);
+            f.lhs_size = lhs_size;
+            f.rhs_size = rhs_size;
+            f.tolerance = check.limit();
+            for (std::size_t i = 0; i < size; ++i) {
+                if (check.within(lhs[i], rhs[i])) {
+                    continue;
+                }
+                ++f.mismatches;
+                // NaN is the maximum error
+                auto error = check.error(lhs[i], rhs[i]);
+                if (f.index == size || error > f.error || (error != error && f.error == f.error)) {
+                    f.index = i;
+                    f.error = error;
+                }
+            }
+            printer::precise lhs_value{0, 0};
+            printer::precise rhs_value{0, 0};
+            if (f.index < size) {
+                auto digits = printer::distinct_digits(static_cast<double>(lhs[f.index]),
+                    static_cast<double>(rhs[f.index]),
+                    max_digits<T1>() > max_digits<T2>() ? max_digits<T1>() : max_digits<T2>());
+                lhs_value = printer::precise{static_cast<double>(lhs[f.index]), digits};
+                rhs_value = printer::precise{static_cast<double>(rhs[f.index]), digits};
+                print_values(f, lhs_value, rhs_value, std::integral_constant<bool, session_reporter::prints_values>());
+            }
+            send_range(f, std::integral_constant<bool, session_reporter::sends_values>());
+            failure(f);
+        }
+
+        YATF_COLD void fail_call(binary_record::failure_t kind, const char *file, int line, std::int32_t site,
+                const char *mock_name, const call_report &report) {
+            ++failed_;
+            if (!report_failure(file, line, site)) {
+                return;
+            }
+            auto f = make_failure(kind, file, line, site, mock_name);
+            f.calls = report.mock;
+            f.print_calls = report.print_calls;
+            if (kind == binary_record::bad_call_count) {
+                failure(f, report.expected, report.actual);
+                return;
+            }
+            f.index = report.out_of_sequence;
+            send_index(f, std::integral_constant<bool, session_reporter::sends_values>());
+            failure(f);
+        }
+
+        bool report_failure(const char *file, int line, std::int32_t site) {
+#if YATF_POSIX
+            // Limits are applied when the test reports failures of helpers
+            if (helper_) {
+                return true;
+            }
+#endif
+            auto &c = get().config_;
+            if (!c.max_failures && !c.max_failures_per_site) {
+                return true;
+            }
+            return current_failure_log().report(file, line, site, c.max_failures, c.max_failures_per_site);
+        }
+
+        static failure_report make_failure(binary_record::failure_t kind, const char *file, int line,
+                std::int32_t site, const char *first, const char *second = "") {
+            failure_report f{};
+            f.file = file;
+            f.line = line;
+            f.site = site;
+            f.kind = kind;
+            f.first = first;
+            f.second = second;
+            return f;
+        }
+
+        void failure(const failure_report &f) {
+#if YATF_POSIX
+            if (helper_) {
+                defer_failure(*this, f);
+                return;
+            }
+#endif
+            get().reporter_.failure(out(), get().report_of(*this), f);
+        }
+
+        template <typename T1, typename T2>
+        void failure(failure_report f, const T1 &lhs, const T2 &rhs) {
+            print_values(f, lhs, rhs, std::integral_constant<bool, session_reporter::prints_values>());
+            send_values(f, lhs, rhs, std::integral_constant<bool, session_reporter::sends_values>());
+            failure(f);
+        }
+
+        template <typename T1, typename T2>
+        static void print_values(failure_report &f, const T1 &lhs, const T2 &rhs, std::true_type) {
+            f.lhs = &lhs;
+            f.rhs = &rhs;
+            f.print_lhs = &print_operand<T1>;
+            f.print_rhs = &print_operand<T2>;
+        }
+
+        template <typename T1, typename T2>
+        static void print_values(failure_report &, const T1 &, const T2 &, std::false_type) {
+        }
+
+        template <typename T1, typename T2>
+        static void send_values(failure_report &f, const T1 &lhs, const T2 &rhs, std::true_type) {
+            if (to_binary_value(lhs, f.values[0]) && to_binary_value(rhs, f.values[1])) {
+                f.value_count = 2;
+            }
+        }
+
+        template <typename T1, typename T2>
+        static void send_values(failure_report &, const T1 &, const T2 &, std::false_type) {
+        }
+
+        template <typename T1, typename T2>
+        static void print_windows(failure_report &f, const range_window<T1> &lhs, const range_window<T2> &rhs,
+                std::true_type) {
+            f.lhs = &lhs;
+            f.rhs = &rhs;
+            f.print_lhs = &print_window<T1>;
+            f.print_rhs = &print_window<T2>;
+        }
+
+        template <typename T1, typename T2>
+        static void print_windows(failure_report &, const range_window<T1> &, const range_window<T2> &,
+                std::false_type) {
+        }
+
+        static void send_range(failure_report &f, std::true_type) {
+            to_binary_value(f.index, f.values[0]);
+            to_binary_value(f.mismatches, f.values[1]);
+            to_binary_value(f.lhs_size, f.values[2]);
+            to_binary_value(f.rhs_size, f.values[3]);
+            f.value_count = 4;
+            if (f.kind != binary_record::range_not_equal) {
+                to_binary_value(f.error, f.values[4]);
+                to_binary_value(f.tolerance, f.values[5]);
+                f.value_count = 6;
+            }
+        }
+
+        static void send_range(failure_report &, std::false_type) {
+        }
+
+        static void send_index(failure_report &f, std::true_type) {
+            to_binary_value(f.index, f.values[0]);
+            f.value_count = 1;
+        }
+
+        static void send_index(failure_report &, std::false_type) {
+        }
+
+        template <typename T1, typename T2>
+        static void send_near(failure_report &f, const T1 &lhs, const T2 &rhs, std::true_type) {
+            to_binary_value(lhs, f.values[0]);
+            to_binary_value(rhs, f.values[1]);
+            to_binary_value(f.error, f.values[2]);
+            to_binary_value(f.tolerance, f.values[3]);
+            f.value_count = 4;
+        }
+
+        template <typename T1, typename T2>
+        static void send_near(failure_report &, const T1 &, const T2 &, std::false_type) {
+        }
+
+        void register_cleanup(cleanup &c) {
+            cleanups_.push_back(c);
+        }
+
+        // Leaves test_body() of a test started by the session. Destructors
+        // of its locals are not run; registered cleanups (e.g. mock
+        // handlers created by REQUIRE_CALL) are run instead, while the
+        // stack is still valid. Outside of the session it does nothing.
+        // A thread started by the test can't leave its body, so there the
+        // failure is only recorded.
+        void abort_test() {
+            if (!abort_point_ || current_test_case_slot() != this) {
+                return;
+            }
+            while (!cleanups_.empty()) {
+                cleanups_.begin()->run();
+            }
+            std::longjmp(*abort_point_, 1);
+        }
+
+        virtual ~test_case() {
+            get().unregister_test(this);
+        }
+
+        virtual void test_body() = 0;
+
+        void reset() {
+            assertions_ = 0;
+            failed_ = 0;
+            signal_ = 0;
+            timed_out_ = false;
+            aborted_ = false;
+            duration_ns_ = 0;
+        }
+
+    protected:
+        const char *suite_name;
+        const char *test_name;
+        unsigned timeout_ms_ = 0;
+        std::int32_t site_ = 0;
+
+    private:
+        friend test_session;
+        friend yatf_fixture;
+        list<test_case>::node node_;
+        std::size_t assertions_ = 0;
+        std::size_t failed_ = 0;
+        int signal_ = 0;
+        bool timed_out_ = false;
+        bool aborted_ = false;
+        std::jmp_buf *abort_point_ = nullptr;
+        list<cleanup> cleanups_{&cleanup::node_};
+        std::uint64_t duration_ns_ = 0;
+        std::uint64_t estimate_ns_ = 0;
+        bool has_estimate_ = false;
+        unsigned shard_ = 0;
+        std::uint32_t hash_ = 0;
+        test_case *index_next_ = nullptr;
+#if YATF_POSIX
+        // Assertions of threads started by the test, guarded by helper_lock_
+        bool helper_ = false;
+        std::mutex helper_lock_;
+        bool accepts_helpers_ = false;
+        std::size_t helper_assertions_ = 0;
+        std::size_t helper_failed_ = 0;
+        helper_failure *helper_failures_ = nullptr;
+#endif
+    };
+
+    // Hash index of registered tests built on the first lookup; tests are
+    // chained through test_case::index_next_, so neither building nor
+    // looking up allocates memory
+    struct test_index final {
+
+        void invalidate() {
+            built_ = false;
+        }
+
+        void build(list<test_case> &tests) {
+            for (auto &bucket : buckets_) {
+                bucket = nullptr;
+            }
+            for (auto &test : tests) {
+                auto &bucket = buckets_[test.hash_ % YATF_TEST_INDEX_BUCKETS];
+                test.index_next_ = bucket;
+                bucket = &test;
+            }
+            built_ = true;
+        }
+
+        bool built() const {
+            return built_;
+        }
+
+        // Chains are built in reverse registration order, so the last
+        // match is the test registered first
+        test_case *find(const char *full_name) const {
+            test_case *result = nullptr;
+            auto hash = hash_string(full_name);
+            for (auto test = buckets_[hash % YATF_TEST_INDEX_BUCKETS]; test; test = test->index_next_) {
+                if (test->hash_ == hash && full_name_equals(*test, full_name)) {
+                    result = test;
+                }
+            }
+            return result;
+        }
+
+    private:
+        static bool full_name_equals(const test_case &test, const char *full_name) {
+            auto suite = test.suite_name;
+            while (*suite && *suite == *full_name) {
+                ++suite, ++full_name;
+            }
+            if (*suite || *full_name++ != '.') {
+                return false;
+            }
+            return compare_strings(test.test_name, full_name) == 0;
+        }
+
+        test_case *buckets_[YATF_TEST_INDEX_BUCKETS] = {};
+        bool built_ = false;
+    };
+
+private:
+
+    list<test_case> test_cases_;
+    test_index index_;
+    test_filter filter_;
+    std::size_t tests_number_ = 0;
+    std::size_t selected_number_ = 0;
+    printer printer_;
+    char printer_buffer_[YATF_PRINTER_BUFFER_SIZE];
+    printf_t printf_ = nullptr;
+    clock_func_t clock_ = default_clock();
+    bool history_loaded_ = false;
+    bool balanced_shards_ = false;
+    std::uint64_t default_estimate_ns_ = 0;
+    config config_;
+    session_reporter reporter_;
+    friend yatf_fixture;
+
+    static test_case *&current_test_case_slot() {
+        static YATF_THREAD_LOCAL test_case *test = nullptr;
+        return test;
+    }
+
+#if YATF_POSIX
+    // Test run serially (i.e. not by --jobs workers) at the moment; other
+    // threads can only be started by it, so their assertions are counted
+    // in it
+    static std::atomic<test_case *> &started_test_case() {
+        static std::atomic<test_case *> test{nullptr};
+        return test;
+    }
+
+    // Test which started the thread, if it's a yatf::thread
+    static test_case *&bound_test_slot() {
+        static YATF_THREAD_LOCAL test_case *test = nullptr;
+        return test;
+    }
+
+    // Assertions made outside of tests (e.g. in threads started by tests run
+    // by --jobs workers, which can't be told apart); they fail the session
+    static std::atomic<std::size_t> &stray_assertions() {
+        static std::atomic<std::size_t> count{0};
+        return count;
+    }
+
+    // Stands for the test in a thread started by it. Assertions of the
+    // thread are counted here, as the test is counted by its own thread
+    // without synchronization, and passed on to the test under its lock
+    // before the next assertion (or when the thread ends). Failures are
+    // kept by the test until its body returns
+    struct helper_test_case final : test_case {
+
+        helper_test_case() {
+            helper_ = true;
+        }
+
+        ~helper_test_case() {
+            flush(nullptr);
+        }
+
+        void test_body() override {
+        }
+
+        YATF_COLD static helper_test_case &attach() {
+            static YATF_THREAD_LOCAL helper_test_case helper;
+            helper.flush(nullptr);
+            auto owner = bound_test_slot();
+            helper.owner_ = owner ? owner : started_test_case().load();
+            return helper;
+        }
+
+        // Passes counted assertions and a failure (if any) to the test, or
+        // counts them as stray if the test isn't running
+        void flush(helper_failure *failure) {
+            if (!assertions_ && !failure) {
+                return;
+            }
+            if (owner_) {
+                std::lock_guard<std::mutex> lock(owner_->helper_lock_);
+                if (owner_->accepts_helpers_) {
+                    owner_->helper_assertions_ += assertions_;
+                    owner_->helper_failed_ += failed_;
+                    assertions_ = failed_ = 0;
+                    if (failure) {
+                        failure->next = owner_->helper_failures_;
+                        owner_->helper_failures_ = failure;
+                        failure = nullptr;
+                    }
+                }
+            }
+            stray_assertions() += assertions_;
+            assertions_ = failed_ = 0;
+            delete failure;
+        }
+
+        void detach() {
+            flush(nullptr);
+            owner_ = nullptr;
+        }
+
+        test_case *owner_ = nullptr;
+    };
+
+    struct text_buffer final {
+        char *data;
+        std::size_t length;
+    };
+
+    static text_buffer *&text_target() {
+        static YATF_THREAD_LOCAL text_buffer *target = nullptr;
+        return target;
+    }
+
+    // Keeps the text truncated to helper_failure::text_size - 1 characters
+    static int text_printf(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto str = va_arg(args, const char *);
+        va_end(args);
+        auto &target = *text_target();
+        while (*str && target.length < helper_failure::text_size - 1) {
+            target.data[target.length++] = *str++;
+        }
+        target.data[target.length] = 0;
+        return 0;
+    }
+
+    static void print_text(printer &out, const void *text) {
+        out << static_cast<const char *>(text);
+    }
+
+    static const char *render(char *buffer, void (*print)(printer &, const void *), const void *value) {
+        text_buffer target{buffer, 0};
+        buffer[0] = 0;
+        text_target() = &target;
+        printer p;
+        p.initialize(&text_printf);
+        print(p, value);
+        text_target() = nullptr;
+        return buffer;
+    }
+
+    YATF_COLD static void defer_failure(test_case &helper, const failure_report &f) {
+        auto failure = new helper_failure;
+        auto &r = failure->report;
+        r = f;
+        if (r.first) {
+            r.first = render(failure->texts[0], &print_text, r.first);
+        }
+        if (r.second) {
+            r.second = render(failure->texts[1], &print_text, r.second);
+        }
+        if (r.print_lhs) {
+            r.lhs = render(failure->texts[2], r.print_lhs, r.lhs);
+            r.print_lhs = &print_text;
+        }
+        if (r.print_rhs) {
+            r.rhs = render(failure->texts[3], r.print_rhs, r.rhs);
+            r.print_rhs = &print_text;
+        }
+        if (r.print_calls) {
+            r.calls = render(failure->texts[4], r.print_calls, r.calls);
+            r.print_calls = &print_text;
+        }
+        static_cast<helper_test_case &>(helper).flush(failure);
+    }
+
+    void open_helpers(test_case &test) {
+        {
+            std::lock_guard<std::mutex> lock(test.helper_lock_);
+            test.accepts_helpers_ = true;
+            test.helper_assertions_ = test.helper_failed_ = 0;
+        }
+        if (!parallel_) {
+            started_test_case().store(&test);
+        }
+    }
+
+    // Failures of helpers are reported (in order) as if the test made them
+    void close_helpers(test_case &test) {
+        if (!parallel_) {
+            started_test_case().store(nullptr);
+        }
+        helper_failure *failures;
+        {
+            std::lock_guard<std::mutex> lock(test.helper_lock_);
+            test.accepts_helpers_ = false;
+            test.assertions_ += test.helper_assertions_;
+            test.failed_ += test.helper_failed_;
+            failures = test.helper_failures_;
+            test.helper_failures_ = nullptr;
+        }
+        helper_failure *ordered = nullptr;
+        while (failures) {
+            auto next = failures->next;
+            failures->next = ordered;
+            ordered = failures;
+            failures = next;
+        }
+        while (ordered) {
+            auto &f = ordered->report;
+            if (test.report_failure(f.file, f.line, f.site)) {
+                reporter_.failure(out(), report_of(test), f);
+            }
+            auto next = ordered->next;
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+    bool parallel_ = false;
+#endif
+
+    static test_case *current_test_case_ptr() {
+        auto test = current_test_case_slot();
+#if YATF_POSIX
+        if (YATF_UNLIKELY(!test)) {
+            test = &helper_test_case::attach();
+        }
+#endif
+        return test;
+    }
+
+    static printer *&current_printer_slot() {
+        static YATF_THREAD_LOCAL printer *p = nullptr;
+        return p;
+    }
+
+    static printer &out() {
+        auto p = current_printer_slot();
+        return p ? *p : get().printer_;
+    }
+
+    static failure_log &current_failure_log() {
+        static YATF_THREAD_LOCAL failure_log log;
+        return log;
+    }
+
+    test_report report_of(const test_case &t) const {
+        return test_report{t.suite_name, t.test_name, t.site_, t.hash_, t.assertions_, t.failed_, t.duration_ns_,
+            clock_ != nullptr};
+    }
+
+    session_report report_of(std::size_t failed) const {
+        return session_report{selected_number_, failed, config_.shard_index, config_.shard_count};
+    }
+
+    void suppressed_failures_message(test_case &t) {
+        current_failure_log().for_each_suppressed([&](const char *file, int line, std::int32_t site, std::size_t count) {
+            reporter_.suppressed(out(), report_of(t), file, line, site, count);
+        });
+    }
+
+    void print_in_color(const char *str, printer::color color) const {
+        if (config_.color) out() << color;
+        out() << str;
+        if (config_.color) out() << printer::color::reset;
+    }
+
+    bool sharded() const {
+        return config_.shard_count > 1;
+    }
+
+    void test_session_start_message() {
+        reporter_.session_start(out(), report_of(0));
+    }
+
+    void test_session_end_message(int failed) {
+        reporter_.session_end(out(), report_of(static_cast<std::size_t>(failed)));
+    }
+
+    void test_start_message(test_case &t) {
+        reporter_.test_start(out(), report_of(t));
+    }
+
+    void test_result(test_case &t) {
+        reporter_.test_end(out(), report_of(t));
+    }
+
+    void slowest_tests_message() {
+        test_case *slowest[YATF_MAX_SLOWEST];
+        auto limit = config_.slowest < YATF_MAX_SLOWEST ? config_.slowest : YATF_MAX_SLOWEST;
+        auto count = 0u;
+        for (auto &test : test_cases_) {
+            if (!selected(test)) {
+                continue;
+            }
+            auto i = count < limit ? count++ : limit;
+            for (; i > 0 && slowest[i - 1]->duration_ns_ < test.duration_ns_; --i) {
+                if (i < limit) slowest[i] = slowest[i - 1];
+            }
+            if (i < limit) slowest[i] = &test;
+        }
+        if (!count) {
+            return;
+        }
+        print_in_color(messages::get(messages::msg::start_end), printer::color::green);
+        out() << " Slowest " << count << " test cases\n";
+        for (auto i = 0u; i < count; ++i) {
+            out() << "  ";
+            print_duration(out(), slowest[i]->duration_ns_);
+            out() << " ms  " << slowest[i]->suite_name << "." << slowest[i]->test_name << "\n";
+        }
+    }
+
+    static bool call_test_body(test_case &test) {
+        std::jmp_buf abort_point;
+        test.abort_point_ = &abort_point;
+        if (setjmp(abort_point) == 0) {
+            test.test_body();
+            test.abort_point_ = nullptr;
+            return false;
+        }
+        test.abort_point_ = nullptr;
+        return true;
+    }
+
+    bool run_test(test_case &test) {
+        test.reset();
+        current_failure_log().reset();
+        start_mock_calls();
+        test_start_message(test);
+        current_test_case_slot() = &test;
+#if YATF_POSIX
+        open_helpers(test);
+#endif
+        auto start = clock_ ? clock_() : 0;
+        test.aborted_ = call_test_body(test);
+        if (clock_) {
+            test.duration_ns_ = clock_() - start;
+        }
+#if YATF_POSIX
+        close_helpers(test);
+#endif
+        stop_mock_calls();
+        suppressed_failures_message(test);
+        test_result(test);
+        return test.failed_ != 0;
+    }
+
+    unsigned run_all() {
+#if YATF_POSIX
+        auto count = 0u;
+        auto tests = schedule(count);
+        // Unless all tests are isolated, only tests with a timeout are forked
+        // (after the other ones)
+        auto in_process = 0u;
+        if (!config_.isolate) {
+            auto end = std::stable_partition(tests, tests + count,
+                [this](const test_case *test) { return !timeout_of(*test); });
+            in_process = static_cast<unsigned>(end - tests);
+        }
+        auto jobs = clamped_jobs(in_process);
+        auto failed = 0u;
+        // Records of tests run at once would be mixed in the binary stream
+        if (jobs > 1 && !config_.binary_output) {
+            failed = run_parallel(tests, in_process, jobs);
+        }
+        else {
+            failed = run_serial(tests, in_process);
+        }
+        if (in_process < count) {
+            failed += run_isolated(tests + in_process, count - in_process, clamped_jobs(count - in_process));
+        }
+        delete [] tests;
+        if (config_.history && clock_) {
+            save_history(config_.history);
+        }
+        return failed;
+#else
+        return run_serial();
+#endif
+    }
+
+    int call_one_test(const char *test_name) {
+        if (auto test = find_test(test_name)) {
+#if YATF_POSIX
+            if (config_.isolate || timeout_of(*test)) {
+                run_isolated(&test, 1, 1);
+                return test->failed_;
+            }
+#endif
+            run_test(*test);
+            return test->failed_;
+        }
+        print_in_color(messages::get(messages::msg::fail), printer::color::red);
+        printer_ << " error because of bad test name\n";
+        return -1;
+    }
+
+    bool in_shard(const test_case &test) const {
+        if (!sharded()) {
+            return true;
+        }
+        if (balanced_shards_) {
+            return test.shard_ == config_.shard_index;
+        }
+        return test.hash_ % config_.shard_count == config_.shard_index;
+    }
+
+    bool selected(const test_case &test) const {
+        return in_shard(test) && filter_.matches(test.suite_name, test.test_name);
+    }
+
+    std::size_t count_selected() {
+        std::size_t count = 0;
+        for (auto &test : test_cases_) {
+            if (selected(test)) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    unsigned run_serial() {
+        auto failed = 0u;
+        for (auto &test : test_cases_) {
+            if (!selected(test)) {
+                continue;
+            }
+            if (run_test(test)) {
+                ++failed;
+            }
+        }
+        return failed;
+    }
+
+#if YATF_POSIX
+
+    unsigned run_serial(test_case **tests, unsigned count) {
+        auto failed = 0u;
+        for (auto i = 0u; i < count; ++i) {
+            if (run_test(*tests[i])) {
+                ++failed;
+            }
+        }
+        return failed;
+    }
+
+#endif
+
+#if YATF_POSIX
+
+    struct parallel_run final {
+        test_case **tests;
+        work_queue *queues;
+        unsigned workers;
+        std::atomic<unsigned> failed{0};
+        std::mutex output_lock;
+    };
+
+    static bool next_test(parallel_run &run, unsigned worker, std::uint32_t &index) {
+        if (run.queues[worker].pop(index)) {
+            return true;
+        }
+        for (auto i = 1u; i < run.workers; ++i) {
+            if (run.queues[(worker + i) % run.workers].steal(index)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(parallel_run &run, unsigned worker) {
+        printer capture;
+        capture.initialize(capture_printf);
+        current_printer_slot() = &capture;
+        auto &output = thread_output();
+        std::uint32_t index;
+        while (next_test(run, worker, index)) {
+            if (run_test(*run.tests[index])) {
+                ++run.failed;
+            }
+            std::lock_guard<std::mutex> lock(run.output_lock);
+            printer_.write(output.c_str());
+            output.clear();
+        }
+        current_printer_slot() = nullptr;
+        current_test_case_slot() = nullptr;
+    }
+
+    test_case **collect_tests(unsigned &count) {
+        auto tests = new test_case *[selected_number_];
+        count = 0u;
+        for (auto &test : test_cases_) {
+            if (selected(test)) {
+                tests[count++] = &test;
+            }
+        }
+        return tests;
+    }
+
+    unsigned run_parallel(test_case **tests, unsigned count, unsigned jobs) {
+        parallel_run run;
+        run.tests = tests;
+        run.queues = new work_queue[jobs];
+        run.workers = jobs;
+        if (history_loaded_) {
+            // Tests are already sorted longest-first; regroup them so each
+            // worker starts with a balanced share and steals the shortest
+            // tests of the others at the end
+            auto bins = new unsigned[count];
+            auto first = new unsigned[jobs + 1]();
+            lpt_assign(tests, count, jobs, bins);
+            for (auto i = 0u; i < count; ++i) {
+                ++first[bins[i] + 1];
+            }
+            for (auto i = 0u; i < jobs; ++i) {
+                first[i + 1] += first[i];
+                run.queues[i].assign(first[i], first[i + 1]);
+            }
+            auto ordered = new test_case *[count];
+            for (auto i = 0u; i < count; ++i) {
+                ordered[first[bins[i]]++] = tests[i];
+            }
+            std::copy(ordered, ordered + count, tests);
+            delete [] ordered;
+            delete [] first;
+            delete [] bins;
+        }
+        else {
+            for (auto i = 0u; i < jobs; ++i) {
+                run.queues[i].assign(
+                    static_cast<std::uint32_t>(static_cast<std::uint64_t>(count) * i / jobs),
+                    static_cast<std::uint32_t>(static_cast<std::uint64_t>(count) * (i + 1) / jobs));
+            }
+        }
+        auto threads = new std::thread[jobs];
+        parallel_ = true;
+        for (auto i = 0u; i < jobs; ++i) {
+            threads[i] = std::thread(&test_session::worker_loop, this, std::ref(run), i);
+        }
+        for (auto i = 0u; i < jobs; ++i) {
+            threads[i].join();
+        }
+        parallel_ = false;
+        delete [] threads;
+        delete [] run.queues;
+        return run.failed.load();
+    }
+
+    std::uint64_t estimate(const test_case &test) const {
+        return test.has_estimate_ ? test.estimate_ns_ : default_estimate_ns_;
+    }
+
+    // Longest first; ties are broken by name, so every shard computes
+    // the same order regardless of the registration order
+    bool runs_longer(const test_case *lhs, const test_case *rhs) const {
+        if (estimate(*lhs) != estimate(*rhs)) {
+            return estimate(*lhs) > estimate(*rhs);
+        }
+        if (lhs->hash_ != rhs->hash_) {
+            return lhs->hash_ < rhs->hash_;
+        }
+        auto suite = compare_strings(lhs->suite_name, rhs->suite_name);
+        return suite ? suite < 0 : compare_strings(lhs->test_name, rhs->test_name) < 0;
+    }
+
+    void sort_longest_first(test_case **tests, unsigned count) const {
+        std::stable_sort(tests, tests + count, [this](const test_case *lhs, const test_case *rhs) {
+            return runs_longer(lhs, rhs);
+        });
+    }
+
+    // Longest-processing-time assignment: tests sorted longest-first go
+    // one by one to the least loaded bin
+    void lpt_assign(test_case **tests, unsigned count, unsigned bin_count, unsigned *bins) const {
+        auto loads = new std::uint64_t[bin_count]();
+        for (auto i = 0u; i < count; ++i) {
+            auto bin = 0u;
+            for (auto j = 1u; j < bin_count; ++j) {
+                if (loads[j] < loads[bin]) {
+                    bin = j;
+                }
+            }
+            loads[bin] += estimate(*tests[i]);
+            bins[i] = bin;
+        }
+        delete [] loads;
+    }
+
+    // Scheduling stage: selected tests in the order they are started
+    test_case **schedule(unsigned &count) {
+        auto tests = collect_tests(count);
+        if (history_loaded_) {
+            sort_longest_first(tests, count);
+        }
+        return tests;
+    }
+
+    void balance_shards() {
+        auto count = 0u;
+        for (auto &test : test_cases_) {
+            if (filter_.matches(test.suite_name, test.test_name)) {
+                ++count;
+            }
+        }
+        auto tests = new test_case *[count];
+        auto bins = new unsigned[count];
+        count = 0u;
+        for (auto &test : test_cases_) {
+            if (filter_.matches(test.suite_name, test.test_name)) {
+                tests[count++] = &test;
+            }
+        }
+        sort_longest_first(tests, count);
+        lpt_assign(tests, count, config_.shard_count, bins);
+        for (auto i = 0u; i < count; ++i) {
+            tests[i]->shard_ = bins[i];
+        }
+        delete [] bins;
+        delete [] tests;
+        balanced_shards_ = true;
+    }
+
+    // History file has a "<nanoseconds> <suite>.<name>" line per test; tests
+    // without history are estimated with the mean of the known durations
+    bool load_history(const char *path) {
+        for (auto &test : test_cases_) {
+            test.has_estimate_ = false;
+        }
+        auto file = std::fopen(path, "r");
+        if (!file) {
+            return false;
+        }
+        char *line = nullptr;
+        std::size_t capacity = 0;
+        std::uint64_t sum = 0, known = 0;
+        ssize_t length;
+        while ((length = ::getline(&line, &capacity, file)) > 0) {
+            if (line[length - 1] == '\n') {
+                line[length - 1] = 0;
+            }
+            char *name;
+            auto duration = std::strtoull(line, &name, 10);
+            if (name == line || *name != ' ') {
+                continue;
+            }
+            if (auto test = find_test(name + 1)) {
+                test->estimate_ns_ = duration;
+                test->has_estimate_ = true;
+                sum += duration;
+                ++known;
+            }
+        }
+        std::free(line);
+        std::fclose(file);
+        default_estimate_ns_ = known ? sum / known : 1000000u;
+        return true;
+    }
+
+    void save_history(const char *path) {
+        auto temp_path = static_cast<char *>(std::malloc(std::strlen(path) + 5));
+        std::sprintf(temp_path, "%s.tmp", path);
+        if (auto file = std::fopen(temp_path, "w")) {
+            for (auto &test : test_cases_) {
+                if (selected(test)) {
+                    std::fprintf(file, "%llu %s.%s\n", static_cast<unsigned long long>(test.duration_ns_),
+                        test.suite_name, test.test_name);
+                }
+                else if (test.has_estimate_) {
+                    std::fprintf(file, "%llu %s.%s\n", static_cast<unsigned long long>(test.estimate_ns_),
+                        test.suite_name, test.test_name);
+                }
+            }
+            std::fclose(file);
+            std::rename(temp_path, path);
+        }
+        std::free(temp_path);
+    }
+
+    struct isolated_child final {
+        pid_t pid = -1;
+        int fd = -1;
+        test_case *test = nullptr;
+        std::uint64_t start = 0;
+        std::uint64_t deadline = 0;
+        output_buffer data;
+    };
 
-        enum class msg { start_end, run, pass, fail };
+    unsigned timeout_of(const test_case &test) const {
+        return test.timeout_ms_ ? test.timeout_ms_ : config_.timeout_ms;
+    }
 
-        static const char *get(msg m) {
-            static const char *run_messages_[4] = {"[========]",  "[  RUN   ]", "[  PASS  ]", "[  FAIL  ]"};
-            return run_messages_[static_cast<int>(m)];
+    [[noreturn]] void run_in_child(test_case &test, int fd) {
+        // Handlers inherited from the host application must not catch the crash
+        for (auto sig : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL}) {
+            std::signal(sig, SIG_DFL);
         }
+        isolation_fd() = fd;
+        if (config_.binary_output) {
+            auto c = config_;
+            c.binary_output = isolated_write;
+            reporter_.select(c);
+        }
+        printer p;
+        p.initialize(isolated_printf);
+        current_printer_slot() = &p;
+        run_test(test);
+        std::uint64_t result[3] = {test.assertions_, test.failed_, test.duration_ns_};
+        send_frame(fd, frame::result, result, sizeof(result));
+        ::_exit(0);
+    }
 
-    };
-
-    struct test_case {
+    bool start_child(isolated_child &child, test_case &test) {
+        int fds[2];
+        if (::pipe(fds)) {
+            return false;
+        }
+        auto pid = ::fork();
+        if (pid < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return false;
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            run_in_child(test, fds[1]);
+        }
+        ::close(fds[1]);
+        test.reset();
+        child.pid = pid;
+        child.fd = fds[0];
+        child.test = &test;
+        child.start = monotonic_ns();
+        child.deadline = timeout_of(test) ? child.start / 1000000u + timeout_of(test) : 0;
+        child.data.clear();
+        return true;
+    }
 
-        void require_true(bool condition, const char *condition_str, const char *file, int line) {
-            ++assertions_;
-            if (!condition) {
-                ++failed_;
-                get().printer_ << "assertion failed: " << file << ':' << line << " \'" << condition_str << "\' is false\n";
+    bool finish_child(isolated_child &child) {
+        int status = 0;
+        while (::waitpid(child.pid, &status, 0) < 0 && errno == EINTR);
+        ::close(child.fd);
+        auto &test = *child.test;
+        auto data = child.data.data();
+        auto left = child.data.size();
+        auto has_result = false;
+        std::uint32_t size;
+        while (left >= 1 + sizeof(size)) {
+            std::memcpy(&size, data + 1, sizeof(size));
+            if (left - 1 - sizeof(size) < size) {
+                break;
+            }
+            auto payload = data + 1 + sizeof(size);
+            if (data[0] == static_cast<char>(frame::output)) {
+                printer_.write(payload, size);
+            }
+            else if (data[0] == static_cast<char>(frame::binary) && config_.binary_output) {
+                config_.binary_output(payload, size);
+            }
+            else if (data[0] == static_cast<char>(frame::result) && size == 3 * sizeof(std::uint64_t)) {
+                std::uint64_t result[3];
+                std::memcpy(result, payload, sizeof(result));
+                test.assertions_ = result[0];
+                test.failed_ = result[1];
+                test.duration_ns_ = result[2];
+                has_result = true;
             }
+            data = payload + size;
+            left -= 1 + sizeof(size) + size;
         }
+        child.pid = -1;
+        child.fd = -1;
+        if (!has_result) {
+            test.duration_ns_ = monotonic_ns() - child.start;
+        }
+        if (test.timed_out_) {
+            ++test.failed_;
+            reporter_.test_timeout(out(), report_of(test), timeout_of(test));
+            return true;
+        }
+        if (!has_result || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            test.signal_ = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+            ++test.failed_;
+            reporter_.test_crash(out(), report_of(test), WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+                WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return true;
+        }
+        return test.failed_ != 0;
+    }
 
-        void require_false(bool condition, const char *condition_str, const char *file, int line) {
-            ++assertions_;
-            if (condition) {
-                ++failed_;
-                get().printer_ << "assertion failed: " << file << ':' << line << " \'" << condition_str << "\' is true\n";
+    static int poll_timeout(isolated_child *children, unsigned count) {
+        auto timeout = -1;
+        auto now = monotonic_ms();
+        for (auto i = 0u; i < count; ++i) {
+            if (children[i].pid < 0 || !children[i].deadline || children[i].test->timed_out_) {
+                continue;
+            }
+            auto left = children[i].deadline > now ? static_cast<int>(children[i].deadline - now) : 0;
+            if (timeout < 0 || left < timeout) {
+                timeout = left;
             }
         }
+        return timeout;
+    }
 
-        template <typename T1, typename T2>
-        void require_eq(const T1 &lhs, const T2 &rhs, const char *lhs_str, const char *rhs_str,
-                const char *file, int line) {
-            ++assertions_;
-            bool cond = (lhs == rhs);
-            if (!cond) {
-                ++failed_;
-                get().printer_ << "assertion failed: " << file << ':' << line << " \'" << lhs_str
-                         << "\' isn't \'" << rhs_str << "\': " << lhs << " != " << rhs << "\n";
+    // A child which has run out of time is killed; its pipe gets closed then,
+    // so it is finished by the regular path in run_isolated
+    static void kill_expired(isolated_child *children, unsigned count) {
+        auto now = monotonic_ms();
+        for (auto i = 0u; i < count; ++i) {
+            auto &child = children[i];
+            if (child.pid < 0 || !child.deadline || child.test->timed_out_ || child.deadline > now) {
+                continue;
             }
+            child.test->timed_out_ = true;
+            ::kill(child.pid, SIGKILL);
         }
+    }
 
-        void require_eq(const char *lhs, const char *rhs, const char *, const char *, const char *file, int line) {
-            ++assertions_;
-            bool cond = compare_strings(lhs, rhs) == 0;
-            if (!cond) {
-                ++failed_;
-                get().printer_ << "assertion failed: " << file << ':' << line << " \'" << lhs
-                         << "\' isn't \'" << rhs << "\n";
+    // Each test is run in a forked child, up to `jobs` children at a time;
+    // the parent gathers their output and prints it when a child exits
+    unsigned run_isolated(test_case **tests, unsigned count, unsigned jobs) {
+        auto children = new isolated_child[jobs];
+        auto fds = new pollfd[jobs];
+        auto next = 0u, running = 0u, failed = 0u;
+        while (next < count || running) {
+            for (auto i = 0u; i < jobs && next < count; ++i) {
+                if (children[i].pid >= 0) {
+                    continue;
+                }
+                if (start_child(children[i], *tests[next])) {
+                    ++running;
+                }
+                else if (run_test(*tests[next])) {
+                    ++failed;
+                }
+                ++next;
+            }
+            if (!running) {
+                continue;
+            }
+            for (auto i = 0u; i < jobs; ++i) {
+                fds[i].fd = children[i].fd;
+                fds[i].events = POLLIN;
+                fds[i].revents = 0;
+            }
+            if (::poll(fds, jobs, poll_timeout(children, jobs)) < 0) {
+                continue;
+            }
+            kill_expired(children, jobs);
+            for (auto i = 0u; i < jobs; ++i) {
+                if (!fds[i].revents) {
+                    continue;
+                }
+                char chunk[4096];
+                auto length = ::read(children[i].fd, chunk, sizeof(chunk));
+                if (length > 0) {
+                    children[i].data.append(chunk, static_cast<std::size_t>(length));
+                    continue;
+                }
+                if (length < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (finish_child(children[i])) {
+                    ++failed;
+                }
+                --running;
             }
         }
+        delete [] fds;
+        delete [] children;
+        return failed;
+    }
 
-        void require_call(const char *mock_name, std::size_t expected_nr_of_calls,
-                std::size_t actual_nr_of_calls, const char *file, int line) {
-            ++assertions_;
-            if (expected_nr_of_calls != actual_nr_of_calls) {
-                ++failed_;
-                get().printer_ << "assertion failed: " << file << ':' << line << " " << mock_name
-                         << ": expected to be called: " << expected_nr_of_calls << "; actual: "
-                         << actual_nr_of_calls << "\n";
-            }
+    unsigned jobs_number() const {
+        if (config_.jobs == 0) {
+            auto cores = std::thread::hardware_concurrency();
+            return cores ? cores : 1;
         }
+        return config_.jobs;
+    }
 
-        virtual void test_body() = 0;
+    unsigned clamped_jobs(unsigned count) const {
+        auto jobs = jobs_number();
+        return jobs > count ? (count ? count : 1) : jobs;
+    }
 
-    protected:
-        const char *suite_name;
-        const char *test_name;
+#endif
 
-    private:
-        friend test_session;
-        friend yatf_fixture;
-        list<test_case>::node node_;
-        std::size_t assertions_ = 0;
-        std::size_t failed_ = 0;
-    };
+#if YATF_POSIX
 
-private:
+    static std::FILE *&output_file() {
+        static std::FILE *file = nullptr;
+        return file;
+    }
 
-    list<test_case> test_cases_;
-    test_case *current_test_case_;
-    std::size_t tests_number_ = 0;
-    printer printer_;
-    config config_;
-    friend yatf_fixture;
+    static int file_printf(const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        auto result = std::vfprintf(output_file(), fmt, args);
+        va_end(args);
+        return result;
+    }
 
-    void print_in_color(const char *str, printer::color color) const {
-        if (config_.color) get().printer_ << color;
-        get().printer_ << str;
-        if (config_.color) get().printer_ << printer::color::reset;
+#endif
+
+    // Output of the session goes to printf unless --out is given; files
+    // are supported on POSIX targets only
+    printf_t open_output(const char *path) {
+#if YATF_POSIX
+        if (path) {
+            output_file() = std::fopen(path, "w");
+            return output_file() ? file_printf : nullptr;
+        }
+#else
+        (void)path;
+#endif
+        return printf_;
     }
 
-    void test_session_start_message() const {
-        print_in_color(messages::get(messages::msg::start_end), printer::color::green);
-        get().printer_ << " Running " << static_cast<int>(tests_number_) << " test cases\n";
+    static void close_output() {
+#if YATF_POSIX
+        if (output_file()) {
+            std::fclose(output_file());
+            output_file() = nullptr;
+        }
+#endif
     }
 
-    void test_session_end_message(int failed) const {
-        if (config_.fails_only && config_.oneliners)
-            get().printer_ << printer::cursor_movement::up;
-        print_in_color(messages::get(messages::msg::start_end), printer::color::green);
-        get().printer_ << " Passed " << static_cast<int>(tests_number_ - failed) << " test cases\n";
-        if (failed) {
-            print_in_color(messages::get(messages::msg::start_end), printer::color::red);
-            get().printer_ << " Failed " << static_cast<int>(failed) << " test cases\n";
+#if YATF_POSIX
+    // Stream written by the target, if it's known
+    static std::FILE *output_stream(printf_t target) {
+        if (output_file()) {
+            return output_file();
         }
+        return target == static_cast<printf_t>(&std::printf) ? stdout : nullptr;
     }
+#endif
 
-    void test_start_message(test_case &t) const {
-        if (config_.fails_only) return;
-        print_in_color(messages::get(messages::msg::run), printer::color::green);
-        get().printer_ << " " << t.suite_name << "." << t.test_name << "\n";
+    static bool text_output(const selectable_reporter &r) {
+        return r.text();
     }
 
-    void test_result(test_case &t) const {
-        if (t.failed_) {
-            print_in_color(messages::get(messages::msg::fail), printer::color::red);
-            get().printer_ << " " << t.suite_name << "." << t.test_name << " (" << static_cast<int>(t.assertions_) << " assertions)\n";
-        }
-        else {
-            if (config_.fails_only) return;
-            if (config_.oneliners)
-                get().printer_ << printer::cursor_movement::up;
-            print_in_color(messages::get(messages::msg::pass), printer::color::green);
-            get().printer_ << " " << t.suite_name << "." << t.test_name << " (" << static_cast<int>(t.assertions_) << " assertions)\n";
-        }
+    static bool text_output(const text_reporter &) {
+        return true;
     }
 
-    int call_one_test(const char *test_name) {
-        char suite_name[512]; // FIXME: what about longer names?
-        copy_string(test_name, suite_name);
-        auto dot_position = find(suite_name, '.');
-        if (dot_position == nullptr) {
+    template <typename Reporter>
+    static bool text_output(const Reporter &) {
+        return false;
+    }
+
+    bool text_output() const {
+        return text_output(reporter_);
+    }
+
+    int run_session(const config &c, const char *test_name) {
+        config_ = c;
+        reporter_.select(config_);
+        if (test_name) {
+            return call_one_test(test_name);
+        }
+        if (!filter_.compile(config_.filter)) {
+            print_in_color(messages::get(messages::msg::fail), printer::color::red);
+            printer_ << " error because of too many filter patterns\n";
             return -1;
         }
-        *dot_position = 0;
-        auto case_name = dot_position + 1;
-        for (auto &test : test_cases_) {
-            if (compare_strings(test.test_name, case_name) == 0 &&
-                    compare_strings(test.suite_name, suite_name) == 0) {
-                test_start_message(test);
-                current_test_case_ = &test;
-                test.test_body();
-                auto result = test.failed_;
-                test_result(test);
-                return result;
-            }
+        if (sharded() && config_.shard_index >= config_.shard_count) {
+            print_in_color(messages::get(messages::msg::fail), printer::color::red);
+            printer_ << " error because of bad shard index\n";
+            return -1;
         }
-        print_in_color(messages::get(messages::msg::fail), printer::color::red);
-        printer_ << " error because of bad test name\n";
-        return -1;
+        balanced_shards_ = false;
+#if YATF_POSIX
+        history_loaded_ = config_.history && load_history(config_.history);
+        if (history_loaded_ && sharded()) {
+            balance_shards();
+        }
+#endif
+        selected_number_ = count_selected();
+        test_session_start_message();
+        auto failed = run_all();
+        if (config_.slowest && clock_ && text_output()) {
+            slowest_tests_message();
+        }
+        test_session_end_message(failed);
+        return failed;
     }
 
 public:
@@ -408,8 +4574,10 @@ public:
     test_session() : test_cases_(&test_case::node_) {
     }
 
-    test_session &initialize(const printf_t printf) {
-        printer_.initialize(printf);
+    test_session &initialize(const printf_t printf, const clock_func_t clock = default_clock()) {
+        printer_.initialize(printf, printer_buffer_, sizeof(printer_buffer_));
+        printf_ = printf;
+        clock_ = clock;
         return *this;
     }
 
@@ -420,38 +4588,116 @@ public:
 
     void register_test(test_case *t) {
         ++tests_number_;
+        t->hash_ = hash_test_name(t->suite_name, t->test_name);
         test_cases_.push_back(*t);
+        index_.invalidate();
+    }
+
+    void unregister_test(test_case *t) {
+        // Helpers of threads aren't registered
+        if (t->node_.next() == &t->node_) {
+            return;
+        }
+        --tests_number_;
+        index_.invalidate();
+    }
+
+    test_case *find_test(const char *full_name) {
+        if (!index_.built()) {
+            index_.build(test_cases_);
+        }
+        return index_.find(full_name);
     }
 
     int run(config c, const char *test_name = nullptr) {
         config_ = c;
-        if (test_name) {
-            return call_one_test(test_name);
+        if (c.bad_option) {
+            print_in_color(messages::get(messages::msg::fail), printer::color::red);
+            printer_ << " error because of bad option " << c.bad_option << "\n";
+            printer_.flush();
+            return -1;
         }
-        auto failed = 0u;
-        test_session_start_message();
-        for (auto &test : test_cases_) {
-            test_start_message(test);
-            current_test_case_ = &test;
-            test.test_body();
-            if (test.failed_) {
-                ++failed;
-            }
-            test_result(test);
+        auto target = open_output(c.out);
+        if (!target) {
+            print_in_color(messages::get(messages::msg::fail), printer::color::red);
+            printer_ << " error because of bad output file\n";
+            printer_.flush();
+            return -1;
         }
-        test_session_end_message(failed);
-        return failed;
+        printer_.initialize(target, printer_buffer_, sizeof(printer_buffer_));
+#if YATF_ASYNC_OUTPUT
+        if (c.async_output) {
+#if YATF_POSIX
+            async_sink::get().start(target, c.overflow, true, output_stream(target));
+#else
+            async_sink::get().start(target, c.overflow, false);
+#endif
+            printer_.initialize(async_sink::print, printer_buffer_, sizeof(printer_buffer_));
+        }
+#endif
+#if YATF_POSIX
+        stray_assertions().store(0);
+#endif
+        auto result = run_session(c, test_name);
+        printer_.initialize(printf_, printer_buffer_, sizeof(printer_buffer_));
+#if YATF_ASYNC_OUTPUT
+        auto dropped = c.async_output ? async_sink::get().stop() : 0;
+#endif
+        close_output();
+#if YATF_ASYNC_OUTPUT
+        if (dropped && (text_output() || c.out)) {
+            print_in_color(messages::get(messages::msg::start_end), printer::color::red);
+            printer_ << " Dropped " << dropped << " bytes of output\n";
+            printer_.flush();
+        }
+#endif
+#if YATF_POSIX
+        if (auto stray = stray_assertions().exchange(0)) {
+            print_in_color(messages::get(messages::msg::fail), printer::color::red);
+            printer_ << " error because of " << stray << " assertions outside of tests\n";
+            printer_.flush();
+            result = -1;
+        }
+#endif
+        // Failures outside of the session are printed as text (if possible)
+        reporter_.select(config());
+        return result;
     }
 
     test_case &current_test_case() {
-        return *current_test_case_;
+        return *current_test_case_ptr();
+    }
+
+    // Used by the assertion macros; unlike get().current_test_case() it does
+    // not go through the guard of the session instance
+    static test_case &current() {
+        return *current_test_case_ptr();
     }
 
     // FIXME: remove this hack
     void current_test_case(test_case *tc) {
-        current_test_case_ = tc; // for tests only
+        current_test_case_slot() = tc; // for tests only
+    }
+
+#if YATF_POSIX
+    // Test for a yatf::thread started by the calling thread
+    static test_case *thread_owner() {
+        auto test = current_test_case_slot();
+        if (!test) {
+            test = bound_test_slot();
+        }
+        return test ? test : started_test_case().load();
     }
 
+    template <typename F, typename ...Args>
+    static void run_thread(test_case *owner, F f, Args ...args) {
+        bound_test_slot() = owner;
+        f(args...);
+        helper_test_case::attach().detach();
+        bound_test_slot() = nullptr;
+    }
+#endif
+
 };
 
 namespace helpers {
@@ -490,13 +4736,11 @@ struct unary_container final {
         }
     }
 
-    template <typename U>
-    void set_by_other_type(const U &v) {
-        value_ = new(data_) U(v);
-    }
-
     template <typename ...Args>
     void set(const Args &...v) {
+        if (value_) {
+            value_->~T();
+        }
         value_ = new(data_) T(v...);
     }
 
@@ -526,7 +4770,7 @@ struct unary_container final {
     }
 
 private:
-    unsigned char data_[Size == 0 ? sizeof(T) : Size];
+    alignas(T) unsigned char data_[Size == 0 ? sizeof(T) : Size];
     T *value_ = nullptr;
 };
 
@@ -534,6 +4778,95 @@ template <>
 class unary_container<void> final {
 };
 
+// Callable kept in a buffer of Size bytes instead of the heap; one which
+// doesn't fit is rejected at compile time
+template <typename Signature, std::size_t Size>
+struct inplace_function;
+
+template <typename R, typename ...Args, std::size_t Size>
+struct inplace_function<R(Args...), Size> final {
+
+    inplace_function() = default;
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, inplace_function>::value
+    >::type>
+    inplace_function(const F &f) {
+        set(f);
+    }
+
+    inplace_function(const inplace_function &other) : call_(other.call_), manage_(other.manage_) {
+        if (manage_) {
+            manage_(&data_, &other.data_);
+        }
+    }
+
+    inplace_function &operator=(const inplace_function &other) {
+        if (this != &other) {
+            reset();
+            if (other.manage_) {
+                other.manage_(&data_, &other.data_);
+            }
+            call_ = other.call_;
+            manage_ = other.manage_;
+        }
+        return *this;
+    }
+
+    ~inplace_function() {
+        reset();
+    }
+
+    template <typename F>
+    void set(const F &f) {
+        static_assert(sizeof(F) <= Size, "callable doesn't fit in inplace_function; increase YATF_MATCHER_SIZE");
+        static_assert(alignof(F) <= alignof(storage), "callable is overaligned for inplace_function");
+        reset();
+        new(&data_) F(f);
+        call_ = &inplace_function::invoke<F>;
+        manage_ = &inplace_function::manage<F>;
+    }
+
+    void reset() {
+        if (manage_) {
+            manage_(&data_, nullptr);
+        }
+        call_ = nullptr;
+        manage_ = nullptr;
+    }
+
+    R operator()(Args ...args) {
+        return call_(&data_, helpers::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const {
+        return call_ != nullptr;
+    }
+
+private:
+    using storage = typename std::aligned_storage<Size>::type;
+
+    template <typename F>
+    static R invoke(void *f, Args ...args) {
+        return (*static_cast<F *>(f))(helpers::forward<Args>(args)...);
+    }
+
+    // Copies src to dst or, without src, destroys dst
+    template <typename F>
+    static void manage(void *dst, const void *src) {
+        if (src) {
+            new(dst) F(*static_cast<const F *>(src));
+        }
+        else {
+            static_cast<F *>(dst)->~F();
+        }
+    }
+
+    storage data_;
+    R (*call_)(void *, Args...) = nullptr;
+    void (*manage_)(void *, const void *) = nullptr;
+};
+
 struct any_value final {};
 
 template <typename T>
@@ -542,6 +4875,126 @@ struct matcher {
     virtual bool match(const T &lhs) = 0;
 };
 
+// Base of matchers known at compile time (made with MATCHER, field(),
+// all_of(), any_of() and not_()); they are combined by value, so a whole
+// expression is inlined into a single call
+template <typename Derived>
+struct matcher_expression {
+};
+
+template <typename ...M>
+struct all_of_matcher;
+
+template <typename M>
+struct all_of_matcher<M> final : matcher_expression<all_of_matcher<M>> {
+
+    constexpr explicit all_of_matcher(const M &m) : first_(m) {
+    }
+
+    template <typename T>
+    bool match(const T &v) const {
+        return first_.match(v);
+    }
+
+private:
+    M first_;
+};
+
+template <typename M, typename ...Rest>
+struct all_of_matcher<M, Rest...> final : matcher_expression<all_of_matcher<M, Rest...>> {
+
+    constexpr explicit all_of_matcher(const M &m, const Rest &...rest) : first_(m), rest_(rest...) {
+    }
+
+    template <typename T>
+    bool match(const T &v) const {
+        return first_.match(v) && rest_.match(v);
+    }
+
+private:
+    M first_;
+    all_of_matcher<Rest...> rest_;
+};
+
+template <typename ...M>
+struct any_of_matcher;
+
+template <typename M>
+struct any_of_matcher<M> final : matcher_expression<any_of_matcher<M>> {
+
+    constexpr explicit any_of_matcher(const M &m) : first_(m) {
+    }
+
+    template <typename T>
+    bool match(const T &v) const {
+        return first_.match(v);
+    }
+
+private:
+    M first_;
+};
+
+template <typename M, typename ...Rest>
+struct any_of_matcher<M, Rest...> final : matcher_expression<any_of_matcher<M, Rest...>> {
+
+    constexpr explicit any_of_matcher(const M &m, const Rest &...rest) : first_(m), rest_(rest...) {
+    }
+
+    template <typename T>
+    bool match(const T &v) const {
+        return first_.match(v) || rest_.match(v);
+    }
+
+private:
+    M first_;
+    any_of_matcher<Rest...> rest_;
+};
+
+template <typename M>
+struct not_matcher final : matcher_expression<not_matcher<M>> {
+
+    constexpr explicit not_matcher(const M &m) : m_(m) {
+    }
+
+    template <typename T>
+    bool match(const T &v) const {
+        return !m_.match(v);
+    }
+
+private:
+    M m_;
+};
+
+template <typename T, typename U, typename M>
+struct field_matcher final : matcher_expression<field_matcher<T, U, M>> {
+
+    constexpr explicit field_matcher(U T::*member, const M &m) : member_(member), m_(m) {
+    }
+
+    bool match(const T &s) const {
+        return m_.match(s.*member_);
+    }
+
+private:
+    U T::*member_;
+    M m_;
+};
+
+template <typename L, typename R>
+constexpr all_of_matcher<L, R> operator&&(const matcher_expression<L> &lhs, const matcher_expression<R> &rhs) {
+    return all_of_matcher<L, R>(static_cast<const L &>(lhs), static_cast<const R &>(rhs));
+}
+
+template <typename L, typename R>
+constexpr any_of_matcher<L, R> operator||(const matcher_expression<L> &lhs, const matcher_expression<R> &rhs) {
+    return any_of_matcher<L, R>(static_cast<const L &>(lhs), static_cast<const R &>(rhs));
+}
+
+template <typename M>
+constexpr not_matcher<M> operator!(const matcher_expression<M> &m) {
+    return not_matcher<M>(static_cast<const M &>(m));
+}
+
 template <std::size_t ...N>
 struct expand {
     using type = expand<N...>;
@@ -560,57 +5013,131 @@ struct choose_nth<0, T, U...> {
     using type = T;
 };
 
+template <typename M, typename T>
+struct is_callable_matcher {
+    template <typename U>
+    static auto test(int) -> decltype(static_cast<bool>(std::declval<U &>()(std::declval<const T &>())), std::true_type());
+
+    template <typename U>
+    static std::false_type test(...);
+
+    constexpr static const bool value = decltype(test<M>(0))::value;
+};
+
+// Matchers are stored by value and called directly; classes derived from
+// matcher<T> too, without going through their vtable
+template <typename M, typename T>
+struct matcher_call final {
+    M m;
+
+    bool operator()(const T &v) {
+        return m.M::match(v);
+    }
+};
+
 template <std::size_t N, typename T>
 struct argument {
 
+    using matcher_type = inplace_function<bool(const T &), YATF_MATCHER_SIZE + 2 * sizeof(T)>;
+
     constexpr explicit argument(const T &val) : value_(val) {
     }
 
-    constexpr explicit argument(any_value) : matcher_([](const T &) { return true; }) {
+    explicit argument(any_value) : matcher_([](const T &) { return true; }) {
+    }
+
+    template <typename Matcher, typename std::enable_if<
+        std::is_base_of<matcher<T>, Matcher>::value || std::is_base_of<matcher_expression<Matcher>, Matcher>::value, int
+    >::type = 0>
+    explicit argument(const Matcher &m) : matcher_(matcher_call<Matcher, T>{m}) {
     }
 
-    template <typename Matcher>
-    explicit argument(const Matcher &m) {
-        m_.set_by_other_type(m);
+    template <typename Matcher, typename std::enable_if<
+        is_callable_matcher<Matcher, T>::value, int
+    >::type = 0>
+    explicit argument(const Matcher &m) : matcher_(m) {
     }
 
     bool match(const T &v) {
         if (matcher_) {
             return matcher_(v);
         }
-        if (m_) {
-            return m_->match(v);
-        }
         return value_ == v;
     }
 
+    // Argument is compared to a stored value with ==
+    bool is_value() const {
+        return !matcher_ && value_;
+    }
+
+    const T &value() const {
+        return value_.get();
+    }
+
 private:
-    bool (*matcher_)(const T &) = nullptr;
+    matcher_type matcher_;
     unary_container<T> value_;
-    unary_container<matcher<T>, 3 * sizeof(matcher<T>) + 2 * sizeof(T)> m_; // FIXME: it would fail for lambdas with capture list
 };
 
-template <typename T, typename U>
-struct field_matcher : public matcher<T> {
+// Arguments which can be hashed by their value and compared with == in a
+// way consistent with the hash; floating-point values are left out, as
+// 0.0 == -0.0 and NaN != NaN
+template <typename T>
+struct is_hashable {
+    using type = typename std::remove_cv<T>::type;
+    constexpr static const bool value = std::is_integral<type>::value || std::is_enum<type>::value
+        || std::is_pointer<type>::value;
+};
+
+template <typename ...T>
+struct all_hashable {
+    constexpr static const bool value = true;
+};
+
+template <typename T, typename ...U>
+struct all_hashable<T, U...> {
+    constexpr static const bool value = is_hashable<T>::value && all_hashable<U...>::value;
+};
+
+template <typename T>
+inline typename std::enable_if<
+    std::is_pointer<T>::value, std::uint64_t
+>::type hash_bits(const T &value) {
+    return reinterpret_cast<std::uintptr_t>(value);
+}
 
-    constexpr explicit field_matcher(U T::*member, const U &value)
-            : offset_(offset_of(member)), value_(value) {
-    }
+template <typename T>
+inline typename std::enable_if<
+    std::is_integral<T>::value || std::is_enum<T>::value, std::uint64_t
+>::type hash_bits(const T &value) {
+    return static_cast<std::uint64_t>(value);
+}
 
-    bool match(const T &s) override {
-        return *reinterpret_cast<const U *>(reinterpret_cast<const char *>(&s) + offset_) == value_.get();
-    }
+// Never called; only lets mocks with other arguments compile
+template <typename T>
+inline typename std::enable_if<
+    !is_hashable<T>::value, std::uint64_t
+>::type hash_bits(const T &) {
+    return 0;
+}
 
-private:
+inline std::uint32_t hash_values(std::uint64_t hash) {
+    return static_cast<std::uint32_t>(hash ^ (hash >> 32));
+}
 
-    constexpr std::size_t offset_of(U T::*member) const {
-        return reinterpret_cast<char *>(&(static_cast<T *>(nullptr)->*member))
-            - static_cast<char *>(nullptr);
-    }
+template <typename T, typename ...U>
+inline std::uint32_t hash_values(std::uint64_t hash, const T &first, const U &...rest) {
+    return hash_values((hash ^ hash_bits(first)) * 0x9e3779b97f4a7c15ull, rest...);
+}
 
-    std::size_t offset_;
-    unary_container<U> value_;
-};
+inline bool all_true() {
+    return true;
+}
+
+template <typename ...T>
+inline bool all_true(bool first, T ...rest) {
+    return first && all_true(rest...);
+}
 
 template <std::size_t L, std::size_t I = 0, typename S = expand<>>
 struct range {
@@ -652,6 +5179,14 @@ struct arguments_impl<expand<N...>, T...> : public argument<N, T>... {
         return compare<M>(first);
     }
 
+    bool is_exact() const {
+        return all_true(argument<N, T>::is_value()...);
+    }
+
+    std::uint32_t hash() const {
+        return hash_values(0xcbf29ce484222325ull, argument<N, T>::value()...);
+    }
+
 };
 
 template <typename ...T>
@@ -676,6 +5211,286 @@ struct is_empty {
     constexpr static const bool value = sizeof...(Args) == 0;
 };
 
+template <typename T>
+struct is_printable {
+    template <typename U>
+    static auto test(int) -> decltype(std::declval<printer &>() << std::declval<const U &>(), std::true_type());
+
+    template <typename U>
+    static std::false_type test(...);
+
+    constexpr static const bool value = decltype(test<T>(0))::value;
+};
+
+// Enums are printed as numbers, values which printer doesn't know as '?'
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type print_argument(printer &out, const T &value) {
+    out << +static_cast<typename std::underlying_type<T>::type>(value);
+}
+
+template <typename T>
+inline typename std::enable_if<
+    !std::is_enum<T>::value && is_printable<T>::value
+>::type print_argument(printer &out, const T &value) {
+    out << value;
+}
+
+template <typename T>
+inline typename std::enable_if<
+    !std::is_enum<T>::value && !is_printable<T>::value
+>::type print_argument(printer &out, const T &) {
+    out << '?';
+}
+
+// Copies of arguments of a call
+template <typename ...T>
+struct call_values {
+    void print(printer &) const {
+    }
+};
+
+template <typename T, typename ...U>
+struct call_values<T, U...> {
+
+    explicit call_values(const T &first, const U &...rest) : first_(first), rest_(rest...) {
+    }
+
+    void print(printer &out) const {
+        print_argument(out, first_);
+        if (sizeof...(U)) {
+            out << ", ";
+        }
+        rest_.print(out);
+    }
+
+private:
+    T first_;
+    call_values<U...> rest_;
+};
+
+// Last Size calls of a mock; a new call takes the place of the oldest one.
+// Slots are claimed without locking: a call which finds its slot still
+// written by another one (possible only with more than Size calls at
+// once) isn't recorded
+template <std::size_t Size, typename ...Args>
+struct call_log final {
+
+    call_log() = default;
+    call_log(const call_log &) = delete;
+    call_log &operator=(const call_log &) = delete;
+
+    ~call_log() {
+        for (auto &s : slots_) {
+            if (s.state.load() == full) {
+                s.get().~record();
+            }
+        }
+    }
+
+    void add(std::uint64_t test, std::uint64_t number, const Args &...args) {
+        auto index = count_.fetch_add(1);
+        auto last_test = test_.load();
+        if (last_test != test && test_.compare_exchange(last_test, test)) {
+            first_.store(index);
+        }
+        auto &s = slots_[index % Size];
+        auto state = s.state.load();
+        if (state == writing || !s.state.compare_exchange(state, writing)) {
+            return;
+        }
+        if (state == full) {
+            s.get().~record();
+        }
+        new (&s.storage) record{test, number, call_values<Args...>(args...)};
+        s.state.store(full);
+    }
+
+    bool empty(std::uint64_t test) const {
+        return test_.load() != test;
+    }
+
+    // Prints "calls: #1 name(a, b), #3 name(c, d)" (without names if
+    // strings are stripped)
+    void print(printer &out, const char *name, std::uint64_t test) const {
+        std::size_t recorded = 0;
+        for (auto &s : slots_) {
+            recorded += s.state.load() == full && s.get().test == test;
+        }
+        auto calls = count_.load() - first_.load();
+        if (recorded < calls) {
+            out << "last " << recorded << " of " << calls << ' ';
+        }
+        out << "calls: ";
+        std::uint64_t last = 0;
+        for (auto i = 0u; i < recorded; ++i) {
+            const record *next = nullptr;
+            for (auto &s : slots_) {
+                if (s.state.load() == full && s.get().test == test && s.get().number > last &&
+                        (!next || s.get().number < next->number)) {
+                    next = &s.get();
+                }
+            }
+            if (!next) {
+                break;
+            }
+            out << (i ? ", #" : "#") << next->number;
+            if (name) {
+                out << ' ' << name;
+            }
+            out << '(';
+            next->values.print(out);
+            out << ')';
+            last = next->number;
+        }
+    }
+
+private:
+    struct record {
+        std::uint64_t test;
+        std::uint64_t number;
+        call_values<Args...> values;
+    };
+
+    enum : unsigned { empty_slot, writing, full };
+
+    struct slot {
+        mock_atomic<unsigned> state{empty_slot};
+        typename std::aligned_storage<sizeof(record), alignof(record)>::type storage;
+
+        record &get() {
+            return *reinterpret_cast<record *>(&storage);
+        }
+
+        const record &get() const {
+            return *reinterpret_cast<const record *>(&storage);
+        }
+    };
+
+    slot slots_[Size];
+    mock_atomic<std::size_t> count_;
+    // Index of the first call in the test which called the mock last
+    mock_atomic<std::uint64_t> test_;
+    mock_atomic<std::size_t> first_;
+};
+
+template <typename ...Args>
+struct call_log<0, Args...> final {
+
+    void add(std::uint64_t, std::uint64_t, const Args &...) {
+    }
+
+    bool empty(std::uint64_t) const {
+        return true;
+    }
+
+    void print(printer &, const char *, std::uint64_t) const {
+    }
+};
+
+template <typename ...Args>
+struct all_copyable {
+    constexpr static const bool value = true;
+};
+
+template <typename T, typename ...U>
+struct all_copyable<T, U...> {
+    constexpr static const bool value = std::is_copy_constructible<T>::value && all_copyable<U...>::value;
+};
+
+#if YATF_THREAD_SAFE_MOCKS
+
+// Read-copy-update guard of handlers of a mock. Calls (readers) don't
+// lock, they only count themselves in the counter of the current epoch;
+// adding and removing handlers (writers) is serialized, and a removed
+// handler can be destroyed only after synchronize() - when calls which
+// could have seen it have left. Flipping the epoch twice makes sure both
+// counters were seen at zero, so new calls can't starve the writer
+struct handlers_guard final {
+
+    struct read_section final {
+
+        explicit read_section(handlers_guard &guard) : guard_(guard), epoch_(guard.epoch_.load()) {
+            guard_.readers_[epoch_].fetch_add(1);
+        }
+
+        ~read_section() {
+            guard_.readers_[epoch_].fetch_sub(1);
+        }
+
+    private:
+        handlers_guard &guard_;
+        unsigned epoch_;
+    };
+
+    void lock() {
+        while (writer_.test_and_set(std::memory_order_acquire)) {
+            relax();
+        }
+    }
+
+    void unlock() {
+        writer_.clear(std::memory_order_release);
+    }
+
+    void synchronize() {
+        for (auto i = 0; i < 2; ++i) {
+            auto old = epoch_.load();
+            epoch_.store(old ^ 1);
+            while (readers_[old].load()) {
+                relax();
+            }
+        }
+    }
+
+private:
+    static void relax() {
+#if YATF_POSIX
+        std::this_thread::yield();
+#endif
+    }
+
+    std::atomic<unsigned> epoch_{0};
+    std::atomic<std::size_t> readers_[2] = {};
+    std::atomic_flag writer_ = ATOMIC_FLAG_INIT;
+};
+
+#else
+
+struct handlers_guard final {
+
+    struct read_section final {
+        explicit read_section(handlers_guard &) {
+        }
+    };
+
+    void lock() {
+    }
+
+    void unlock() {
+    }
+
+    void synchronize() {
+    }
+};
+
+#endif
+
+template <typename R, typename ...Args>
+struct mock_handler;
+
+// Expectations added to a sequence with in_sequence() have to be called in
+// the order in which they were added (each of them as many times as it
+// expects); a call of an earlier expectation after a later one fails
+struct sequence final {
+
+private:
+    template <typename R, typename ...Args>
+    friend struct mock_handler;
+
+    std::size_t expectations_ = 0;
+    mock_atomic<std::size_t> position_;
+};
+
 template <typename T>
 class mock;
 
@@ -683,16 +5498,23 @@ template <typename R, typename ...Args>
 struct mock_handler final {
 
     ~mock_handler() {
-        if (scheduled_assert_) {
-            scheduled_assert_(expected_nr_of_calls_, actual_nr_of_calls_);
+        if (scheduled_report_) {
+            scheduled_report_(call_report{expected_nr_of_calls_, actual_nr_of_calls_.load(), sequence_ != nullptr,
+                out_of_sequence_.load(), mock_, mock_ ? mock_->calls_printer() : nullptr});
+        }
+        else if (scheduled_assert_) {
+            scheduled_assert_(expected_nr_of_calls_, actual_nr_of_calls_.load());
+        }
+        if (mock_) {
+            mock_->unregister(*this);
         }
     }
 
-    template <typename T = mock_handler &>
+    template <typename Matcher, typename T = mock_handler &>
     typename std::enable_if<
         !is_empty<Args...>::value, T
-    >::type match_args(bool (*matcher)(Args ...)) {
-        matcher_ = matcher;
+    >::type match_args(const Matcher &matcher) {
+        matcher_.set(matcher);
         return *this;
     }
 
@@ -709,6 +5531,9 @@ struct mock_handler final {
         !is_empty<T...>::value, U
     >::type for_arguments(T ...args) {
         arguments_.set(args...);
+        if (mock_) {
+            mock_->reindex(*this);
+        }
         return *this;
     }
 
@@ -716,21 +5541,77 @@ struct mock_handler final {
         scheduled_assert_ = l;
     }
 
+    void schedule_assertion(void (*l)(const call_report &)) {
+        scheduled_report_ = l;
+    }
+
+    mock_handler &in_sequence(sequence &s) {
+        sequence_ = &s;
+        sequence_position_ = s.expectations_++;
+        return *this;
+    }
+
     mock_handler &times(std::size_t nr = 1) {
         expected_nr_of_calls_ = nr;
         return *this;
     }
 
+    cleanup &abort_cleanup() {
+        return cleanup_;
+    }
+
 private:
     friend mock<R(Args...)>;
 
     void (*scheduled_assert_)(std::size_t, std::size_t) = nullptr;
-    bool (*matcher_)(Args ...) = nullptr;
+    void (*scheduled_report_)(const call_report &) = nullptr;
+    inplace_function<bool(const Args &...), YATF_MATCHER_SIZE> matcher_;
     std::size_t expected_nr_of_calls_ = 1;
-    std::size_t actual_nr_of_calls_ = 0;
+    mock_atomic<std::size_t> actual_nr_of_calls_;
     unary_container<R> return_value_;
     unary_container<arguments<Args...>> arguments_;
-    typename list<mock_handler>::node node_;
+    cleanup cleanup_{&mock_handler::abandon, this};
+    mock<R(Args...)> *mock_ = nullptr;
+    // Links of the list of the mock (next_ is followed by calls, prev_
+    // only by the mock adding and removing handlers) or of an index bucket
+    mock_atomic<mock_handler *> next_;
+    mock_handler *prev_ = nullptr;
+    mock_atomic<mock_handler *> index_next_;
+    std::size_t order_ = 0;
+    std::uint32_t hash_ = 0;
+    bool listed_ = false;
+    bool indexed_ = false;
+    sequence *sequence_ = nullptr;
+    std::size_t sequence_position_ = 0;
+    mock_atomic<std::uint64_t> out_of_sequence_;
+
+    // Test was aborted, so expectations are not verified
+    static void abandon(void *object) {
+        auto handler = static_cast<mock_handler *>(object);
+        if (handler->mock_) {
+            handler->mock_->unregister(*handler);
+        }
+        handler->scheduled_assert_ = nullptr;
+        handler->scheduled_report_ = nullptr;
+    }
+
+    bool matches_exactly(const Args &...args) {
+        return arguments_->compare(args...);
+    }
+
+    void count_call(std::uint64_t number) {
+        actual_nr_of_calls_.fetch_add(1);
+        if (!sequence_) {
+            return;
+        }
+        auto position = sequence_->position_.load();
+        while (position < sequence_position_ && !sequence_->position_.compare_exchange(position, sequence_position_)) {
+        }
+        if (sequence_position_ < position) {
+            std::uint64_t none = 0;
+            out_of_sequence_.compare_exchange(none, number);
+        }
+    }
 
     template <typename T = R>
     typename std::enable_if<
@@ -742,30 +5623,20 @@ private:
     template <typename T = bool>
     typename std::enable_if<
         is_empty<Args...>::value, T
-    >::type operator()() {
-        ++actual_nr_of_calls_;
+    >::type matches() {
         return true;
     }
 
     template <typename T = bool>
     typename std::enable_if<
         !is_empty<Args...>::value, T
-    >::type operator()(const Args &...args) {
+    >::type matches(const Args &...args) {
         if (arguments_) {
-            bool is_matched = arguments_->compare(args...);
-            if (is_matched) {
-                ++actual_nr_of_calls_;
-            }
-            return is_matched;
+            return arguments_->compare(args...);
         }
         if (matcher_) {
-            bool is_matched = matcher_(args...);
-            if (is_matched) {
-                ++actual_nr_of_calls_;
-            }
-            return is_matched;
+            return matcher_(args...);
         }
-        ++actual_nr_of_calls_;
         return true;
     }
 
@@ -774,56 +5645,307 @@ private:
 template <typename T>
 class mock final {};
 
+// Handlers expecting exact values of all arguments are kept in a hash index
+// instead of the list, so a call doesn't have to compare its arguments with
+// every expectation; the remaining handlers (matchers, wildcards, no
+// arguments) are still scanned in order of registration. Last calls are
+// kept in a log (YATF_MOCK_CALL_LOG_SIZE of them) printed when an
+// expectation fails. Neither of them allocates memory. With
+// YATF_THREAD_SAFE_MOCKS calls can come from any thread and never lock;
+// handlers are added and removed under handlers_guard
 template <typename R, typename ...Args>
 struct mock<R(Args...)> final {
 
-    mock() : handlers_(&mock_handler<R, Args...>::node_) {
+    using handler_type = mock_handler<R, Args...>;
+
+    constexpr static const bool indexable = sizeof...(Args) > 0 && all_hashable<Args...>::value;
+
+    explicit mock(const char *name = nullptr) : name_(name) {
     }
 
-    void register_handler(mock_handler<R, Args...> &handler) {
-        handlers_.push_back(handler);
+    void register_handler(handler_type &handler) {
+        guard_.lock();
+        handler.mock_ = this;
+        handler.order_ = next_order_++;
+        append(handler);
+        guard_.unlock();
     }
 
-    mock_handler<R, Args...> get_handler() const {
+    handler_type get_handler() const {
         return {};
     }
 
+    // Each call is counted by every matching handler
     template <typename T = R>
     typename std::enable_if<
         std::is_void<T>::value, T
     >::type operator()(Args ...args) {
-        for (auto it = handlers_.begin(); it != handlers_.end(); ++it) {
-            (*it)(helpers::forward<Args>(args)...);
+        auto &calls = current_mock_calls();
+        auto number = calls.number.fetch_add(1) + 1;
+        log_.add(calls.test.load(), number, args...);
+        handlers_guard::read_section section(guard_);
+        if (indexed_handlers_.load()) {
+            auto hash = hash_values(0xcbf29ce484222325ull, args...);
+            for (auto h = buckets_[hash % buckets].load(); h; h = h->index_next_.load()) {
+                if (h->hash_ == hash && h->matches_exactly(args...)) {
+                    h->count_call(number);
+                }
+            }
+        }
+        for (auto h = first_.load(); h; h = h->next_.load()) {
+            if (h->matches(helpers::forward<Args>(args)...)) {
+                h->count_call(number);
+            }
         }
     }
 
+    // Value is returned by the first matching handler in order of
+    // registration, whether it is indexed or not
     template <typename T = R>
     typename std::enable_if<
         !std::is_void<T>::value, T
     >::type operator()(Args ...args) {
-        for (auto it = handlers_.begin(); it != handlers_.end(); ++it) {
-            if ((*it)(helpers::forward<Args>(args)...)) {
-                return it->get_return_value();
+        auto &calls = current_mock_calls();
+        auto number = calls.number.fetch_add(1) + 1;
+        log_.add(calls.test.load(), number, args...);
+        handlers_guard::read_section section(guard_);
+        handler_type *first = nullptr;
+        if (indexed_handlers_.load()) {
+            auto hash = hash_values(0xcbf29ce484222325ull, args...);
+            for (auto h = buckets_[hash % buckets].load(); h; h = h->index_next_.load()) {
+                if (h->hash_ == hash && (!first || h->order_ < first->order_) && h->matches_exactly(args...)) {
+                    first = h;
+                }
+            }
+        }
+        for (auto h = first_.load(); h; h = h->next_.load()) {
+            if (first && h->order_ > first->order_) {
+                break;
             }
+            if (h->matches(helpers::forward<Args>(args)...)) {
+                h->count_call(number);
+                return h->get_return_value();
+            }
+        }
+        if (first) {
+            first->count_call(number);
+            return first->get_return_value();
         }
         return default_return_value_.get();
     }
 
 private:
+    friend handler_type;
+
+    constexpr static const std::size_t buckets = indexable ? YATF_MOCK_INDEX_BUCKETS : 1;
+
+    using log_type = call_log<all_copyable<typename std::decay<Args>::type...>::value ? YATF_MOCK_CALL_LOG_SIZE : 0,
+        typename std::decay<Args>::type...>;
+
+    static void print_calls(printer &out, const void *object) {
+        auto &m = *static_cast<const mock *>(object);
+        m.log_.print(out, m.name_, current_mock_calls().test.load());
+    }
+
+    // Calls are printed with failures only if there were any
+    void (*calls_printer() const)(printer &, const void *) {
+        return log_.empty(current_mock_calls().test.load()) ? nullptr : &mock::print_calls;
+    }
+
+    // Called when the handler got its arguments; it is moved from the list
+    // to the index if all of them are exact values. Calls going through
+    // the handler still follow its old link, so it's safe to move it
+    // without waiting for them, unless it's moved back
+    void reindex(handler_type &handler) {
+        guard_.lock();
+        if (handler.indexed_) {
+            unindex(handler);
+            guard_.synchronize();
+            append(handler);
+        }
+        if (indexable && handler.arguments_->is_exact()) {
+            unlink(handler);
+            handler.hash_ = handler.arguments_->hash();
+            auto &bucket = buckets_[handler.hash_ % buckets];
+            handler.index_next_.store(bucket.load());
+            bucket.store(&handler);
+            handler.indexed_ = true;
+            indexed_handlers_.fetch_add(1);
+        }
+        guard_.unlock();
+    }
+
+    void unregister(handler_type &handler) {
+        guard_.lock();
+        if (handler.indexed_) {
+            unindex(handler);
+        }
+        unlink(handler);
+        guard_.synchronize();
+        handler.mock_ = nullptr;
+        guard_.unlock();
+    }
+
+    void append(handler_type &handler) {
+        handler.next_.store(nullptr);
+        handler.prev_ = last_;
+        if (last_) {
+            last_->next_.store(&handler);
+        }
+        else {
+            first_.store(&handler);
+        }
+        last_ = &handler;
+        handler.listed_ = true;
+    }
+
+    void unlink(handler_type &handler) {
+        if (!handler.listed_) {
+            return;
+        }
+        auto next = handler.next_.load();
+        if (handler.prev_) {
+            handler.prev_->next_.store(next);
+        }
+        else {
+            first_.store(next);
+        }
+        if (next) {
+            next->prev_ = handler.prev_;
+        }
+        else {
+            last_ = handler.prev_;
+        }
+        handler.listed_ = false;
+    }
+
+    void unindex(handler_type &handler) {
+        auto h = &buckets_[handler.hash_ % buckets];
+        for (auto next = h->load(); next; h = &next->index_next_, next = h->load()) {
+            if (next == &handler) {
+                h->store(handler.index_next_.load());
+                break;
+            }
+        }
+        handler.indexed_ = false;
+        indexed_handlers_.fetch_add(static_cast<std::size_t>(-1));
+    }
+
+    const char *name_;
     unary_container<R> default_return_value_;
-    list<mock_handler<R, Args...>> handlers_;
+    handlers_guard guard_;
+    mock_atomic<handler_type *> first_;
+    handler_type *last_ = nullptr;
+    log_type log_;
+    mock_atomic<handler_type *> buckets_[buckets];
+    mock_atomic<std::size_t> indexed_handlers_;
+    std::size_t next_order_ = 0;
 };
 
 } // namespace detail
 
+#define YATF_STRINGIFY_(x) #x
+#define YATF_STRINGIFY(x) YATF_STRINGIFY_(x)
+
+#if YATF_CALL_SITES
+#define YATF_SITE_(counter, first, second) \
+    ([]() -> std::int32_t { \
+        static const yatf::detail::site_record<sizeof(__FILE__ "\0" first "\0" second)> record \
+            __attribute__((section("yatf_sites." YATF_STRINGIFY(counter)))) = {__LINE__, __FILE__ "\0" first "\0" second}; \
+        return yatf::detail::site_id(&record); \
+    }())
+#define YATF_SITE(first, second) YATF_SITE_(__COUNTER__, first, second)
+#else
+#define YATF_SITE(first, second) 0
+#endif
+
+// With YATF_STRIP_STRINGS assertions pass only their site ids; the strings
+// are kept in yatf_sites.* sections, which can be removed from the image
+#if YATF_STRIP_STRINGS
+#define YATF_TEXT(str) nullptr
+#define YATF_FILE nullptr
+#define YATF_LINE 0
+#else
+#define YATF_TEXT(str) str
+#define YATF_FILE __FILE__
+#define YATF_LINE __LINE__
+#endif
+
 #define REQUIRE(cond) \
-    yatf::detail::test_session::get().current_test_case().require_true(cond, #cond, __FILE__, __LINE__)
+    yatf::detail::test_session::current().require_true(cond, YATF_TEXT(#cond), YATF_FILE, \
+        YATF_LINE, YATF_SITE(#cond, ""))
 
 #define REQUIRE_FALSE(cond) \
-    yatf::detail::test_session::get().current_test_case().require_false(cond, #cond, __FILE__, __LINE__)
+    yatf::detail::test_session::current().require_false(cond, YATF_TEXT(#cond), YATF_FILE, \
+        YATF_LINE, YATF_SITE(#cond, ""))
 
 #define REQUIRE_EQ(lhs, rhs) \
-    yatf::detail::test_session::get().current_test_case().require_eq(lhs, rhs, #lhs, #rhs, __FILE__, __LINE__)
+    yatf::detail::test_session::current().require_eq(lhs, rhs, YATF_TEXT(#lhs), YATF_TEXT(#rhs), \
+        YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_RANGE_EQ(lhs, rhs) \
+    yatf::detail::test_session::current().require_range_eq(lhs, rhs, YATF_TEXT(#lhs), YATF_TEXT(#rhs), \
+        YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_MEM_EQ(lhs, rhs, size) \
+    yatf::detail::test_session::current().require_mem_eq(lhs, rhs, size, YATF_TEXT(#lhs), YATF_TEXT(#rhs), \
+        YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_NEAR(lhs, rhs, tolerance) \
+    yatf::detail::test_session::current().require_near(lhs, rhs, tolerance, YATF_TEXT(#lhs), YATF_TEXT(#rhs), \
+        YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_ULP_EQ(lhs, rhs, max_ulps) \
+    yatf::detail::test_session::current().require_ulp_eq(lhs, rhs, max_ulps, YATF_TEXT(#lhs), YATF_TEXT(#rhs), \
+        YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_RANGE_NEAR(lhs, rhs, tolerance) \
+    yatf::detail::test_session::current().require_range_near(lhs, rhs, tolerance, YATF_TEXT(#lhs), \
+        YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define REQUIRE_RANGE_ULP_EQ(lhs, rhs, max_ulps) \
+    yatf::detail::test_session::current().require_range_ulp_eq(lhs, rhs, max_ulps, YATF_TEXT(#lhs), \
+        YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, YATF_SITE(#lhs, #rhs))
+
+#define YATF_ASSERT(check) \
+    do { \
+        auto &yatf_test_case_ = yatf::detail::test_session::current(); \
+        if (!yatf_test_case_.check) yatf_test_case_.abort_test(); \
+    } while (0)
+
+#define ASSERT(cond) \
+    YATF_ASSERT(require_true(cond, YATF_TEXT(#cond), YATF_FILE, YATF_LINE, YATF_SITE(#cond, "")))
+
+#define ASSERT_FALSE(cond) \
+    YATF_ASSERT(require_false(cond, YATF_TEXT(#cond), YATF_FILE, YATF_LINE, YATF_SITE(#cond, "")))
+
+#define ASSERT_EQ(lhs, rhs) \
+    YATF_ASSERT(require_eq(lhs, rhs, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_RANGE_EQ(lhs, rhs) \
+    YATF_ASSERT(require_range_eq(lhs, rhs, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_MEM_EQ(lhs, rhs, size) \
+    YATF_ASSERT(require_mem_eq(lhs, rhs, size, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_NEAR(lhs, rhs, tolerance) \
+    YATF_ASSERT(require_near(lhs, rhs, tolerance, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_ULP_EQ(lhs, rhs, max_ulps) \
+    YATF_ASSERT(require_ulp_eq(lhs, rhs, max_ulps, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_RANGE_NEAR(lhs, rhs, tolerance) \
+    YATF_ASSERT(require_range_near(lhs, rhs, tolerance, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
+
+#define ASSERT_RANGE_ULP_EQ(lhs, rhs, max_ulps) \
+    YATF_ASSERT(require_range_ulp_eq(lhs, rhs, max_ulps, YATF_TEXT(#lhs), YATF_TEXT(#rhs), YATF_FILE, YATF_LINE, \
+        YATF_SITE(#lhs, #rhs)))
 
 #define YATF_CONCAT_(x,y) x##y
 #define YATF_CONCAT(x,y) YATF_CONCAT_(x, y)
@@ -836,6 +5958,8 @@ private:
         explicit suite##__##name(const char *sn, const char *tn) { \
             suite_name = sn; \
             test_name = tn; \
+            timeout_ms_ = yatf::detail::fixture_timeout<f>(nullptr); \
+            site_ = YATF_SITE(#suite, #name); \
             yatf::detail::test_session::get().register_test(this); \
         } \
         void test_body() override; \
@@ -849,22 +5973,24 @@ private:
 #define TEST(...) GET_4TH(__VA_ARGS__, YATF_TEST_FIXTURE, YATF_TEST)(__VA_ARGS__)
 
 #define MOCK(signature, name) \
-    yatf::detail::mock<signature> name
+    yatf::detail::mock<signature> name{YATF_TEXT(#name)}
 
 #define REQUIRE_CALL(name) \
     auto YATF_UNIQUE_NAME(__mock_handler) = name.get_handler(); \
     name.register_handler(YATF_UNIQUE_NAME(__mock_handler)); \
-    YATF_UNIQUE_NAME(__mock_handler).schedule_assertion([](std::size_t expected, std::size_t actual) { \
-        yatf::detail::test_session::get().current_test_case().require_call(#name, expected, actual, __FILE__, __LINE__); \
+    yatf::detail::test_session::current().register_cleanup(YATF_UNIQUE_NAME(__mock_handler).abort_cleanup()); \
+    YATF_UNIQUE_NAME(__mock_handler).schedule_assertion([](const yatf::detail::call_report &report) { \
+        yatf::detail::test_session::current().require_call(YATF_TEXT(#name), report, \
+            YATF_FILE, YATF_LINE, YATF_SITE(#name, "")); \
     }); \
     (void)YATF_UNIQUE_NAME(__mock_handler)
 
 #define MATCHER(name, lhs) \
     template <typename T> \
-    struct name##_matcher : public yatf::detail::matcher<T> { \
+    struct name##_matcher : public yatf::detail::matcher_expression<name##_matcher<T>> { \
         explicit name##_matcher(const T &val) : arg(val) { \
         } \
-        bool match(const T &lhs) override; \
+        bool match(const T &lhs) const; \
     private: \
         const T arg; \
     }; \
@@ -873,7 +5999,7 @@ private:
         return name##_matcher<T>(v); \
     } \
     template <typename T> \
-    bool name##_matcher<T>::match(const T &lhs)
+    bool name##_matcher<T>::match(const T &lhs) const
 
 MATCHER(eq, n) { return arg == n; }
 MATCHER(ne, n) { return arg != n; }
@@ -882,30 +6008,116 @@ MATCHER(gt, n) { return n > arg; }
 MATCHER(le, n) { return n <= arg; }
 MATCHER(lt, n) { return n < arg; }
 
+template <unsigned Milliseconds>
+struct timeout {
+    static constexpr unsigned yatf_timeout_ms = Milliseconds;
+};
+
 template <typename T, typename U>
-inline detail::field_matcher<T, U> field(U T::*member, const U &val) {
-    return detail::field_matcher<T, U>(member, val);
+inline detail::field_matcher<T, U, eq_matcher<U>> field(U T::*member, const U &val) {
+    return detail::field_matcher<T, U, eq_matcher<U>>(member, eq(val));
+}
+
+template <typename T, typename U, typename M>
+inline detail::field_matcher<T, U, M> field(U T::*member, const detail::matcher_expression<M> &m) {
+    return detail::field_matcher<T, U, M>(member, static_cast<const M &>(m));
 }
 
+template <typename ...M>
+inline detail::all_of_matcher<M...> all_of(const detail::matcher_expression<M> &...m) {
+    return detail::all_of_matcher<M...>(static_cast<const M &>(m)...);
+}
+
+template <typename ...M>
+inline detail::any_of_matcher<M...> any_of(const detail::matcher_expression<M> &...m) {
+    return detail::any_of_matcher<M...>(static_cast<const M &>(m)...);
+}
+
+template <typename M>
+inline detail::not_matcher<M> not_(const detail::matcher_expression<M> &m) {
+    return detail::not_matcher<M>(static_cast<const M &>(m));
+}
+
+using detail::sequence;
+
 namespace {
 detail::any_value _;
 } // namespace
 
+// Options with malformed values are reported by run(), which then doesn't
+// run any test
 inline config read_config(unsigned argc, const char **argv) {
     config c;
+    auto read_unsigned = [&c](const char *option, const char *value, unsigned &field) {
+        if (!detail::parse_unsigned(value, field)) c.bad_option = option;
+    };
     for (unsigned i = 1; i < argc; ++i) {
         if (!detail::compare_strings(argv[i], "--no-color")) c.color = false;
         if (!detail::compare_strings(argv[i], "--oneliners")) c.oneliners = true;
         if (!detail::compare_strings(argv[i], "--fails-only")) c.fails_only = true;
+        if (auto value = detail::skip_prefix(argv[i], "--jobs=")) read_unsigned(argv[i], value, c.jobs);
+        if (!detail::compare_strings(argv[i], "--isolate")) c.isolate = true;
+        if (auto value = detail::skip_prefix(argv[i], "--timeout=")) read_unsigned(argv[i], value, c.timeout_ms);
+        if (auto value = detail::skip_prefix(argv[i], "--filter=")) c.filter = value;
+        if (auto value = detail::skip_prefix(argv[i], "--slowest=")) read_unsigned(argv[i], value, c.slowest);
+        if (auto value = detail::skip_prefix(argv[i], "--shard-index=")) read_unsigned(argv[i], value, c.shard_index);
+        if (auto value = detail::skip_prefix(argv[i], "--shard-count=")) read_unsigned(argv[i], value, c.shard_count);
+        if (auto value = detail::skip_prefix(argv[i], "--history=")) c.history = value;
+        if (auto value = detail::skip_prefix(argv[i], "--max-failures=")) read_unsigned(argv[i], value, c.max_failures);
+        if (auto value = detail::skip_prefix(argv[i], "--max-failures-per-site=")) {
+            read_unsigned(argv[i], value, c.max_failures_per_site);
+        }
+        if (!detail::compare_strings(argv[i], "--async")) c.async_output = true;
+        if (!detail::compare_strings(argv[i], "--async=drop")) {
+            c.async_output = true;
+            c.overflow = overflow_policy::drop;
+        }
+        if (auto value = detail::skip_prefix(argv[i], "--reporter=")) {
+            if (!detail::parse_reporter(value, c.reporter)) c.bad_option = argv[i];
+        }
+        if (auto value = detail::skip_prefix(argv[i], "--out=")) c.out = value;
     }
     return c;
 }
 
+#if YATF_ASYNC_OUTPUT
+
+// Passes output buffered by --async to printf; on targets without threads
+// it has to be called periodically, e.g. from an idle hook
+inline void drain_output() {
+    detail::async_sink::get().drain();
+}
+
+#endif
+
+#if YATF_POSIX
+
+// std::thread (for functions and function objects) whose assertions are
+// counted in the test which started it, also when tests are run by --jobs
+// workers. It has to be joined before the test ends
+struct thread : std::thread {
+
+    thread() = default;
+
+    template <typename F, typename ...Args>
+    explicit thread(F &&f, Args &&...args)
+        : std::thread(&detail::test_session::run_thread<typename std::decay<F>::type,
+                typename std::decay<Args>::type...>,
+            detail::test_session::thread_owner(), std::forward<F>(f), std::forward<Args>(args)...) {
+    }
+};
+
+#endif
+
 inline int main(printf_t print_func, unsigned argc = 0, const char **argv = nullptr) {
     (void)_;
     return detail::test_session::get().initialize(print_func).run(read_config(argc, argv));
 }
 
+inline int main(printf_t print_func, clock_func_t clock_func, unsigned argc, const char **argv) {
+    return detail::test_session::get().initialize(print_func, clock_func).run(read_config(argc, argv));
+}
+
 inline int main(printf_t print_func, config &c) {
     return detail::test_session::get().initialize(print_func).run(c);
 }
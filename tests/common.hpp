@@ -38,19 +38,19 @@ struct yatf_fixture {
     }
 
     static std::size_t get_assertions() {
-        return yatf::detail::test_session::get().current_test_case_->assertions_;
+        return yatf::detail::test_session::get().current_test_case_slot()->assertions_;
     }
 
     static std::size_t get_failed() {
-        return yatf::detail::test_session::get().current_test_case_->failed_;
+        return yatf::detail::test_session::get().current_test_case_slot()->failed_;
     }
 
     static const char *get_suite_name() {
-        return yatf::detail::test_session::get().current_test_case_->suite_name;
+        return yatf::detail::test_session::get().current_test_case_slot()->suite_name;
     }
 
     static const char *get_test_name() {
-        return yatf::detail::test_session::get().current_test_case_->test_name;
+        return yatf::detail::test_session::get().current_test_case_slot()->test_name;
     }
 
 };
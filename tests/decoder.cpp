@@ -0,0 +1,284 @@
+#include "../include/yatf.hpp"
+#include "../tools/decoder.hpp"
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "common.hpp"
+
+using namespace yatf::detail;
+
+namespace {
+
+MOCK(void(), decoder_mock);
+
+// Tests are created only by the cases which run them; TEST would register
+// them for every session
+struct decoder_test_case : public dummy_test_case {
+
+    explicit decoder_test_case(const char *name, std::int32_t site, int failures = 0)
+            : dummy_test_case("decoder", name), failures(failures) {
+        site_ = site;
+    }
+
+protected:
+    int failures;
+};
+
+struct passing_test_case : public decoder_test_case {
+
+    passing_test_case() : decoder_test_case("passing", YATF_SITE("decoder", "passing")) {
+    }
+
+    void test_body() override {
+        REQUIRE(true);
+        REQUIRE_EQ(failures, failures);
+    }
+
+};
+
+struct failing_test_case : public decoder_test_case {
+
+    explicit failing_test_case(int failures)
+            : decoder_test_case("failing", YATF_SITE("decoder", "failing"), failures) {
+    }
+
+    void test_body() override {
+        REQUIRE(failures == 0);
+        REQUIRE_FALSE(failures != 0);
+        REQUIRE_EQ(-failures, 0);
+        REQUIRE_EQ(static_cast<unsigned>(failures), 0u);
+        for (auto i = 0; i < 1234 * failures; ++i) {
+            REQUIRE_EQ(i, -1);
+        }
+        REQUIRE_CALL(decoder_mock).times(failures + 1);
+        decoder_mock();
+    }
+
+};
+
+struct ranges_test_case : public decoder_test_case {
+
+    ranges_test_case() : decoder_test_case("ranges", YATF_SITE("decoder", "ranges")) {
+    }
+
+    void test_body() override {
+        unsigned char frame[] = {1, 2, 3, 4};
+        unsigned char expected[] = {1, 0, 3, 0};
+        REQUIRE_RANGE_EQ(frame, expected);
+        double samples[] = {1, 2, 3};
+        double reference[] = {1, 2.5, 3};
+        REQUIRE_RANGE_NEAR(samples, reference, 0.25);
+        auto x = 1.0f;
+        auto y = std::nextafter(std::nextafter(x, 2.0f), 2.0f);
+        REQUIRE_ULP_EQ(x, y, 1);
+    }
+
+};
+
+struct crashing_test_case : public decoder_test_case {
+
+    crashing_test_case() : decoder_test_case("crash", YATF_SITE("decoder", "crash")) {
+    }
+
+    void test_body() override {
+        REQUIRE(true);
+        std::abort();
+    }
+
+};
+
+struct hanging_test_case : public decoder_test_case {
+
+    hanging_test_case() : decoder_test_case("hang", YATF_SITE("decoder", "hang")) {
+        timeout_ms_ = 50;
+    }
+
+    void test_body() override {
+        REQUIRE(true);
+        for (;;) {
+            pause();
+        }
+    }
+
+};
+
+std::string text_output;
+
+int text_printf(const char *fmt, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, fmt);
+    auto i = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    text_output += line;
+    return i;
+}
+
+int stream_fd;
+
+int pipe_write(const void *data, std::size_t size) {
+    return write(stream_fd, data, size);
+}
+
+std::uint64_t fake_now;
+
+// Calls recorded by mocks are printed only with text failures, they're not
+// sent in binary records
+std::string without_calls(std::string output) {
+    for (std::size_t pos; (pos = output.find("; calls: #")) != std::string::npos;) {
+        output.erase(pos, output.find_first_of("\n\"<", pos) - pos);
+    }
+    return output;
+}
+
+std::uint64_t fake_clock() {
+    return fake_now += 1500000;
+}
+
+} // namespace anon
+
+BOOST_AUTO_TEST_SUITE(decoder_suite)
+
+BOOST_FIXTURE_TEST_CASE(can_decode_binary_results, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<passing_test_case>());
+    tests.push_back(std::make_unique<failing_test_case>(1));
+    test_session::get().initialize(text_printf, fake_clock);
+    yatf::config c{false, false, false, 1, false, 0, "decoder.*"};
+    c.max_failures_per_site = 2;
+    text_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    stream_fd = fds[1];
+    c.binary_output = pipe_write;
+    text_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK(text_output.empty());
+    close(fds[1]);
+    std::string stream;
+    char buf[512];
+    for (ssize_t size; (size = read(fds[0], buf, sizeof(buf))) > 0;) {
+        stream.append(buf, size);
+    }
+    close(fds[0]);
+    BOOST_CHECK_EQUAL(stream.size() % sizeof(binary_record), 0u);
+
+    yatf::tools::site_table sites;
+    BOOST_REQUIRE(sites.load("/proc/self/exe"));
+    dynamic_reporter<text_reporter> text;
+    dynamic_reporter<junit_reporter> junit;
+    text.get().configure(false, false, false);
+    yatf::tools::decoder decoder(sites);
+    std::ostringstream decoded, decoded_junit;
+    decoder.add(text, decoded);
+    decoder.add(junit, decoded_junit);
+    std::istringstream in(stream);
+    BOOST_CHECK(decoder.decode(in));
+    test_session::get().initialize(text_printf, fake_clock);
+    text_output.clear();
+    c.binary_output = nullptr;
+    test_session::get().run(c);
+    BOOST_CHECK_EQUAL(decoded.str(), without_calls(text_output));
+    BOOST_CHECK(text_output.find("... 1,232 more failures at " + std::string(__FILE__) + ":") != std::string::npos);
+    BOOST_CHECK(text_output.find("decoder_mock: expected to be called: 2; actual: 1; calls: #1 decoder_mock()\n")
+        != std::string::npos);
+    BOOST_CHECK_EQUAL(decoder.failed(), 1u);
+
+    text_output.clear();
+    c.reporter = yatf::reporter_type::junit;
+    test_session::get().run(c);
+    BOOST_CHECK_EQUAL(decoded_junit.str(), without_calls(text_output));
+    BOOST_CHECK(text_output.find("<testsuite name=\"yatf\" tests=\"2\">") != std::string::npos);
+    BOOST_CHECK(text_output.find("<testcase classname=\"decoder\" name=\"passing\" time=\"0.001500\"/>")
+        != std::string::npos);
+    BOOST_CHECK(text_output.find("&apos;failures == 0&apos; is false\"") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_decode_crashes_and_timeouts, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<passing_test_case>());
+    tests.push_back(std::make_unique<crashing_test_case>());
+    tests.push_back(std::make_unique<hanging_test_case>());
+    tests.push_back(std::make_unique<failing_test_case>(0));
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    stream_fd = fds[1];
+    yatf::config c{false, false, false, 2, true, 0, "decoder.*"};
+    c.binary_output = pipe_write;
+    test_session::get().initialize(text_printf, fake_clock);
+    text_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 2);
+    BOOST_CHECK(text_output.empty());
+    close(fds[1]);
+    std::string stream;
+    char buf[512];
+    for (ssize_t size; (size = read(fds[0], buf, sizeof(buf))) > 0;) {
+        stream.append(buf, size);
+    }
+    close(fds[0]);
+
+    yatf::tools::site_table sites;
+    BOOST_REQUIRE(sites.load("/proc/self/exe"));
+    dynamic_reporter<text_reporter> text;
+    dynamic_reporter<junit_reporter> junit;
+    text.get().configure(false, false, false);
+    yatf::tools::decoder decoder(sites);
+    std::ostringstream decoded, decoded_junit;
+    decoder.add(text, decoded);
+    decoder.add(junit, decoded_junit);
+    std::istringstream in(stream);
+    BOOST_CHECK(decoder.decode(in));
+    BOOST_CHECK_EQUAL(decoder.failed(), 2u);
+    BOOST_CHECK(decoded.str().find("[ CRASH  ] decoder.crash (signal " + std::to_string(SIGABRT)) != std::string::npos);
+    BOOST_CHECK(decoded.str().find("[TIMEOUT ] decoder.hang (exceeded 50 ms)\n") != std::string::npos);
+    BOOST_CHECK(decoded.str().find("[  PASS  ] decoder.failing") != std::string::npos);
+    BOOST_CHECK(decoded_junit.str().find("name=\"crash\"") != std::string::npos);
+    BOOST_CHECK(decoded_junit.str().find("<error message=\"exceeded 50 ms\" type=\"timeout\"/>") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_decode_range_failures, yatf_fixture) {
+    auto test = std::make_unique<ranges_test_case>();
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    stream_fd = fds[1];
+    yatf::config c{false, false, false, 1, false, 0, "decoder.ranges"};
+    c.binary_output = pipe_write;
+    test_session::get().initialize(text_printf, fake_clock);
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    close(fds[1]);
+    std::string stream;
+    char buf[512];
+    for (ssize_t size; (size = read(fds[0], buf, sizeof(buf))) > 0;) {
+        stream.append(buf, size);
+    }
+    close(fds[0]);
+
+    yatf::tools::site_table sites;
+    BOOST_REQUIRE(sites.load("/proc/self/exe"));
+    dynamic_reporter<text_reporter> text;
+    text.get().configure(false, false, false);
+    yatf::tools::decoder decoder(sites);
+    std::ostringstream decoded;
+    decoder.add(text, decoded);
+    std::istringstream in(stream);
+    BOOST_CHECK(decoder.decode(in));
+    BOOST_CHECK(decoded.str().find(" 'frame' isn't 'expected': 2 of 4 differ, first at 1\n") != std::string::npos);
+    BOOST_CHECK(decoded.str().find(" 'samples' isn't near 'reference': 1 of 3 differ, max error 0.5 > 0.25 at 1\n")
+        != std::string::npos);
+    BOOST_CHECK(decoded.str().find(" 'x' isn't near 'y': 1 != 1.00000024, error 2 > 1 ulps\n") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
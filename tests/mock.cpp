@@ -1,6 +1,8 @@
 #include <ctime>
 #include <limits>
 #include <memory>
+#include <thread>
+#include <vector>
 #include <utility>
 #include <cstdlib>
 #include <boost/test/unit_test.hpp>
@@ -461,6 +463,92 @@ BOOST_FIXTURE_TEST_CASE(can_match_arguments_by_field, yatf_fixture) {
     } while (0);
 }
 
+struct point {
+    int x;
+    int y;
+
+    bool operator==(const point &p) const {
+        return p.x == x && p.y == y;
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(can_combine_matchers, yatf_fixture) {
+    using ::yatf::all_of;
+    using ::yatf::any_of;
+    using ::yatf::not_;
+    using ::yatf::eq;
+    using ::yatf::gt;
+    using ::yatf::lt;
+    static_assert(sizeof(all_of(gt(3), lt(10))) == 2 * sizeof(int), "combined matchers are kept by value");
+    static_assert(sizeof(field(&point::x, gt(0)) && field(&point::y, lt(0))) == 2 * sizeof(field(&point::x, gt(0))),
+        "combined matchers are kept by value");
+    do {
+        mock<int(int)> dummy_mock;
+        GET_HANDLER(dummy_mock, handler);
+        handler.schedule_assertion([](std::size_t, std::size_t actual) {
+            BOOST_CHECK_EQUAL(actual, 5);
+        });
+        handler.for_arguments(all_of(gt(3), lt(10), not_(eq(5)))).will_return(1);
+        for (auto i = 0; i < 16; ++i) {
+            BOOST_CHECK_EQUAL(dummy_mock(i), i > 3 && i < 10 && i != 5 ? 1 : 0);
+        }
+    } while (0);
+    do {
+        mock<int(int, point)> dummy_mock;
+        GET_HANDLER(dummy_mock, handler);
+        handler.schedule_assertion([](std::size_t, std::size_t actual) {
+            BOOST_CHECK_EQUAL(actual, 3);
+        });
+        handler.for_arguments(any_of(lt(0), gt(100)) || eq(50), field(&point::x, 1) && !field(&point::y, lt(0)))
+            .will_return(2);
+        BOOST_CHECK_EQUAL(dummy_mock(-1, point{1, 0}), 2);
+        BOOST_CHECK_EQUAL(dummy_mock(101, point{1, 5}), 2);
+        BOOST_CHECK_EQUAL(dummy_mock(50, point{1, 5}), 2);
+        BOOST_CHECK_EQUAL(dummy_mock(49, point{1, 5}), 0);
+        BOOST_CHECK_EQUAL(dummy_mock(-1, point{2, 5}), 0);
+        BOOST_CHECK_EQUAL(dummy_mock(-1, point{1, -1}), 0);
+    } while (0);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_match_arguments_with_capturing_lambdas, yatf_fixture) {
+    int limit = 10;
+    std::size_t seen = 0;
+    do {
+        mock<int(int, helper)> dummy_mock;
+        GET_HANDLER(dummy_mock, handler);
+        handler.schedule_assertion([](std::size_t, std::size_t actual) {
+            BOOST_CHECK_EQUAL(actual, 2);
+        });
+        handler.for_arguments([&](int x) { return ++seen, x > limit; }, field(&helper::a, 3)).will_return(7);
+        BOOST_CHECK_EQUAL(dummy_mock(11, helper(3)), 7);
+        BOOST_CHECK_EQUAL(dummy_mock(10, helper(3)), int());
+        BOOST_CHECK_EQUAL(dummy_mock(11, helper(4)), int());
+        limit = 20;
+        BOOST_CHECK_EQUAL(dummy_mock(11, helper(3)), int());
+        BOOST_CHECK_EQUAL(dummy_mock(21, helper(3)), 7);
+    } while (0);
+    BOOST_CHECK_EQUAL(seen, 5);
+    do {
+        mock<void(int, int)> dummy_mock;
+        GET_HANDLER(dummy_mock, handler);
+        handler.schedule_assertion([](std::size_t, std::size_t actual) {
+            BOOST_CHECK_EQUAL(actual, 1);
+        });
+        handler.match_args([&limit](int a, int b) { return a + b == limit; });
+        dummy_mock(10, 9);
+        dummy_mock(10, 10);
+    } while (0);
+    do {
+        auto shared = std::make_shared<int>(4);
+        mock<void(int)> dummy_mock;
+        GET_HANDLER(dummy_mock, handler);
+        handler.for_arguments([shared](int x) { return x == *shared; });
+        BOOST_CHECK_EQUAL(shared.use_count(), 2);
+        handler.for_arguments(5);
+        BOOST_CHECK_EQUAL(shared.use_count(), 1);
+    } while (0);
+}
+
 struct some_struct {
     MOCK(int(int), some_method);
     MOCK(int(int), some_other_method);
@@ -483,7 +571,7 @@ BOOST_FIXTURE_TEST_CASE(require_call_works, yatf_fixture) {
     } while (0);
     BOOST_CHECK_EQUAL(get_assertions(), 1);
     BOOST_CHECK_EQUAL(get_failed(), 1);
-    std::string comp("assertion failed: " + std::string(__FILE__) + std::string(":482 dummy_mock: expected to be called: 1; actual: 0\n"));
+    std::string comp("assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 4) + std::string(" dummy_mock: expected to be called: 1; actual: 0\n"));
     BOOST_CHECK_EQUAL(get_buffer(), comp);
     reset_buffer();
     do {
@@ -493,5 +581,216 @@ BOOST_FIXTURE_TEST_CASE(require_call_works, yatf_fixture) {
     BOOST_CHECK_EQUAL(get_buffer(), "");
 }
 
-BOOST_AUTO_TEST_SUITE_END()
+BOOST_FIXTURE_TEST_CASE(indexed_handlers_keep_order_of_registration, yatf_fixture) {
+    mock<int(int, int)> dummy_mock;
+    do {
+        GET_HANDLER(dummy_mock, handler1);
+        GET_HANDLER(dummy_mock, handler2);
+        GET_HANDLER(dummy_mock, handler3);
+        GET_HANDLER(dummy_mock, handler4);
+        GET_HANDLER(dummy_mock, handler5);
+        auto assertion = [](std::size_t expected, std::size_t actual) {
+            BOOST_CHECK_EQUAL(expected, actual);
+        };
+        handler1.schedule_assertion(assertion);
+        handler2.schedule_assertion(assertion);
+        handler3.schedule_assertion(assertion);
+        handler4.schedule_assertion(assertion);
+        handler5.schedule_assertion(assertion);
+        handler1.for_arguments(1, _).will_return(10).times(2);
+        handler2.for_arguments(1, 2).will_return(20).times(0);
+        handler3.for_arguments(3, 4).will_return(30).times(1);
+        handler4.for_arguments(3, _).will_return(40).times(1);
+        handler5.for_arguments(3, 4).will_return(50).times(0);
+        BOOST_CHECK_EQUAL(dummy_mock(1, 2), 10);
+        BOOST_CHECK_EQUAL(dummy_mock(3, 4), 30);
+        BOOST_CHECK_EQUAL(dummy_mock(3, 5), 40);
+        BOOST_CHECK_EQUAL(dummy_mock(1, 5), 10);
+        BOOST_CHECK_EQUAL(dummy_mock(7, 7), 0);
+    } while (0);
+    BOOST_CHECK_EQUAL(dummy_mock(3, 4), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(indexed_handlers_of_void_mock_count_every_call, yatf_fixture) {
+    mock<void(int)> dummy_mock;
+    do {
+        GET_HANDLER(dummy_mock, handler1);
+        GET_HANDLER(dummy_mock, handler2);
+        GET_HANDLER(dummy_mock, handler3);
+        auto assertion = [](std::size_t expected, std::size_t actual) {
+            BOOST_CHECK_EQUAL(expected, actual);
+        };
+        handler1.schedule_assertion(assertion);
+        handler2.schedule_assertion(assertion);
+        handler3.schedule_assertion(assertion);
+        handler1.for_arguments(1).times(2);
+        handler2.for_arguments(1).times(2);
+        handler3.for_arguments(_).times(3);
+        dummy_mock(1);
+        dummy_mock(1);
+        dummy_mock(2);
+    } while (0);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_index_many_handlers, yatf_fixture) {
+    enum class color { red, green };
+    using handler_type = mock_handler<long, unsigned, color>;
+    mock<long(unsigned, color)> dummy_mock;
+    do {
+        std::unique_ptr<handler_type[]> handlers(new handler_type[1000]);
+        for (auto i = 0u; i < 1000; ++i) {
+            dummy_mock.register_handler(handlers[i]);
+            handlers[i].for_arguments(i, i % 3 ? color::red : color::green).will_return(i * 2 + 1);
+        }
+        for (auto i = 0u; i < 1000; ++i) {
+            BOOST_CHECK_EQUAL(dummy_mock(i, i % 3 ? color::red : color::green), i * 2 + 1);
+            BOOST_CHECK_EQUAL(dummy_mock(i, i % 3 ? color::green : color::red), 0);
+        }
+        handlers[500].~handler_type();
+        new (&handlers[500]) handler_type();
+        BOOST_CHECK_EQUAL(dummy_mock(500, color::red), 0);
+        BOOST_CHECK_EQUAL(dummy_mock(501, color::green), 1003);
+    } while (0);
+    BOOST_CHECK_EQUAL(dummy_mock(501, color::green), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_verify_sequence_across_mocks, yatf_fixture) {
+    mock<int(const char *)> open{"open"};
+    mock<int(int, int)> write{"write"};
+    mock<void(int)> close{"close"};
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    start_mock_calls();
+    do {
+        yatf::sequence seq;
+        REQUIRE_CALL(open).in_sequence(seq).will_return(3);
+        REQUIRE_CALL(write).in_sequence(seq).times(2);
+        REQUIRE_CALL(close).in_sequence(seq);
+        open("file");
+        write(3, 10);
+        write(3, 20);
+        close(3);
+    } while (0);
+    BOOST_CHECK_EQUAL(get_assertions(), 6);
+    BOOST_CHECK_EQUAL(get_failed(), 0);
+    BOOST_CHECK_EQUAL(get_buffer(), "");
+    do {
+        yatf::sequence seq;
+        REQUIRE_CALL(open).in_sequence(seq).will_return(3);
+        REQUIRE_CALL(write).in_sequence(seq);
+        REQUIRE_CALL(close).in_sequence(seq);
+        open("file");
+        close(3);
+        write(3, 10);
+    } while (0);
+    std::string comp("assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 6) +
+        " write: called out of sequence (call #7); calls: #2 write(3, 10), #3 write(3, 20), #7 write(3, 10)\n");
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    BOOST_CHECK_EQUAL(get_assertions(), 12);
+    BOOST_CHECK_EQUAL(get_failed(), 1);
+}
 
+BOOST_FIXTURE_TEST_CASE(failed_expectations_print_recorded_calls, yatf_fixture) {
+    enum class color { red, green };
+    mock<int(int, int)> sum{"sum"};
+    mock<void(helper, color)> paint{"paint"};
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    start_mock_calls();
+    do {
+        REQUIRE_CALL(sum).for_arguments(2, 3).will_return(5);
+        sum(2, 4);
+        sum(1, 1);
+    } while (0);
+    std::string comp("assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 4) +
+        " sum: expected to be called: 1; actual: 0; calls: #1 sum(2, 4), #2 sum(1, 1)\n");
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    do {
+        REQUIRE_CALL(paint).times(2);
+        paint(helper(1), color::green);
+    } while (0);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 3) +
+        " paint: expected to be called: 2; actual: 1; calls: #3 paint(?, 1)\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    do {
+        REQUIRE_CALL(sum);
+        for (auto i = 0; i < YATF_MOCK_CALL_LOG_SIZE + 4; ++i) {
+            sum(i, 0);
+        }
+    } while (0);
+    comp = "; last " + std::to_string(YATF_MOCK_CALL_LOG_SIZE) + " of " + std::to_string(YATF_MOCK_CALL_LOG_SIZE + 6) +
+        " calls: #8 sum(4, 0), #9 sum(5, 0), ";
+    BOOST_CHECK(get_buffer().find(comp) != std::string::npos);
+    reset_buffer();
+    start_mock_calls();
+    do {
+        REQUIRE_CALL(sum).times(0);
+    } while (0);
+    BOOST_CHECK_EQUAL(get_buffer(), "");
+    do {
+        REQUIRE_CALL(sum);
+    } while (0);
+    BOOST_CHECK(get_buffer().find("sum: expected to be called: 1; actual: 0\n") != std::string::npos);
+}
+
+#if YATF_THREAD_SAFE_MOCKS
+BOOST_FIXTURE_TEST_CASE(can_be_called_from_many_threads, yatf_fixture) {
+    constexpr unsigned threads = 64;
+    constexpr unsigned calls = 1000;
+    mock<int(unsigned, unsigned)> sum{"sum"};
+    mock<void(unsigned)> sink{"sink"};
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    start_mock_calls();
+    do {
+        yatf::sequence seq;
+        REQUIRE_CALL(sink).for_arguments(_).times(threads * (calls + 2));
+        REQUIRE_CALL(sink).for_arguments(calls).in_sequence(seq).times(threads);
+        REQUIRE_CALL(sink).for_arguments(calls + 1).in_sequence(seq).times(threads);
+        std::unique_ptr<mock_handler<int, unsigned, unsigned>[]> handlers(
+            new mock_handler<int, unsigned, unsigned>[threads]);
+        for (auto i = 0u; i < threads; ++i) {
+            sum.register_handler(handlers[i]);
+            handlers[i].for_arguments(i, 1u).will_return(i + 1).times(calls);
+            handlers[i].schedule_assertion([](std::size_t expected, std::size_t actual) {
+                BOOST_CHECK_EQUAL(actual, expected);
+            });
+        }
+        std::vector<std::thread> workers;
+        for (auto i = 0u; i < threads; ++i) {
+            workers.emplace_back([&sum, &sink, i] {
+                for (auto j = 0u; j < calls; ++j) {
+                    if (sum(i, 1) != static_cast<int>(i + 1)) {
+                        return;
+                    }
+                    sink(j);
+                }
+            });
+        }
+        // Handlers come and go while the mocks are called
+        for (auto j = 0u; j < calls; ++j) {
+            auto handler = sum.get_handler();
+            sum.register_handler(handler);
+            handler.for_arguments(threads + j, 1u).times(0);
+            decltype(sum)::handler_type wildcard;
+            sum.register_handler(wildcard);
+            wildcard.for_arguments(threads, _).times(0);
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+        for (auto i = 0u; i < threads; ++i) {
+            sink(calls);
+        }
+        for (auto i = 0u; i < threads; ++i) {
+            sink(calls + 1);
+        }
+    } while (0);
+    BOOST_CHECK_EQUAL(get_buffer(), "");
+    BOOST_CHECK_EQUAL(get_failed(), 0);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
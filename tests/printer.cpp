@@ -3,6 +3,9 @@
 #include <string>
 #include <iomanip>
 #include <sstream>
+#include <cstdarg>
+#include <cstdio>
+#include <limits>
 #include "common.hpp"
 
 using namespace yatf::detail;
@@ -51,6 +54,38 @@ BOOST_FIXTURE_TEST_CASE(can_print_unsigned_int, yatf_fixture) {
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(can_print_64bit_integers, yatf_fixture) {
+    for (auto value : {std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max(), -1ll,
+            5000000000ll}) {
+        printer << value;
+        BOOST_CHECK_EQUAL(get_buffer(), std::to_string(value));
+    }
+    for (auto value : {std::numeric_limits<unsigned long long>::max(), 0ull, 1ull << 40}) {
+        printer << value;
+        BOOST_CHECK_EQUAL(get_buffer(), std::to_string(value));
+    }
+    printer << std::numeric_limits<std::size_t>::max();
+    BOOST_CHECK_EQUAL(get_buffer(), std::to_string(std::numeric_limits<std::size_t>::max()));
+}
+
+BOOST_FIXTURE_TEST_CASE(can_print_floating_point, yatf_fixture) {
+    for (auto value : {0.0, 1.0, -1.0, 0.5, 1.5, 3.14159265, 2.0 / 3, 100000.0, 123456.0, 1234567.0, 999999.7,
+            0.0001, 0.000123456, 1e-5, -2.5e-7, 1e10, 1e100, 1e300, 6.02214076e23, 1.5e-300}) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%g", value);
+        printer << value;
+        BOOST_CHECK_EQUAL(get_buffer(), expected);
+    }
+    printer << 0.25f;
+    BOOST_CHECK_EQUAL(get_buffer(), "0.25");
+    printer << std::numeric_limits<double>::infinity();
+    BOOST_CHECK_EQUAL(get_buffer(), "inf");
+    printer << -std::numeric_limits<double>::infinity();
+    BOOST_CHECK_EQUAL(get_buffer(), "-inf");
+    printer << std::numeric_limits<double>::quiet_NaN();
+    BOOST_CHECK_EQUAL(get_buffer(), "nan");
+}
+
 BOOST_FIXTURE_TEST_CASE(can_print_address, yatf_fixture) {
     for (unsigned int i = 0; i < 1025; i++) {
         printer << reinterpret_cast<void *>(i);
@@ -95,5 +130,59 @@ BOOST_FIXTURE_TEST_CASE(can_print_string, yatf_fixture) {
     BOOST_CHECK_EQUAL(get_buffer(), str);
 }
 
+namespace {
+
+int printf_calls = 0;
+
+int counting_print(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char line[256];
+    auto i = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    ++printf_calls;
+    print("%s", line);
+    return i;
+}
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(can_buffer_lines, yatf_fixture) {
+    char line[32];
+    printf_calls = 0;
+    printer.initialize(counting_print, line, sizeof(line));
+    printer << "value: " << -12 << ' ' << 4000000000u << '\n';
+    BOOST_CHECK_EQUAL(printf_calls, 1);
+    BOOST_CHECK_EQUAL(get_buffer(), "value: -12 4000000000\n");
+    printer << "abc" << 1;
+    BOOST_CHECK_EQUAL(printf_calls, 1);
+    printer.flush();
+    BOOST_CHECK_EQUAL(printf_calls, 2);
+    BOOST_CHECK_EQUAL(get_buffer(), "abc1");
+    printer.flush();
+    BOOST_CHECK_EQUAL(printf_calls, 2);
+    printf_calls = 0;
+    printer << reinterpret_cast<void *>(0xbeef) << ' ' << nullptr << printer::color::red;
+    printer.initialize(print);
+    BOOST_CHECK_EQUAL(printf_calls, 1);
+    BOOST_CHECK_EQUAL(get_buffer(), "0xbeef NULL\e[31m");
+    printer.initialize(counting_print, line, 4);
+    printer << "abcdefg";
+    printer.flush();
+    BOOST_CHECK_EQUAL(printf_calls, 4);
+    BOOST_CHECK_EQUAL(get_buffer(), "abcdefg");
+}
+
+BOOST_FIXTURE_TEST_CASE(passes_only_finished_strings_to_printf, yatf_fixture) {
+    std::string str(100, 'a');
+    printf_calls = 0;
+    printer.initialize(counting_print);
+    printer.write(str.c_str(), 70);
+    BOOST_CHECK_EQUAL(printf_calls, 2);
+    BOOST_CHECK_EQUAL(get_buffer(), str.substr(0, 70));
+    printer << "%d%s" << 'x' << -7;
+    BOOST_CHECK_EQUAL(get_buffer(), "%d%sx-7");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,80 @@
+#define YATF_STRIP_STRINGS 1
+#include "../include/yatf.hpp"
+#include "../tools/decoder.hpp"
+#include <boost/test/unit_test.hpp>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "common.hpp"
+
+using namespace yatf::detail;
+
+namespace {
+
+int stripped_value = 3;
+MOCK(void(), stripped_mock);
+MOCK(void(int), stripped_sink);
+
+TEST(strip, failing) {
+    REQUIRE(stripped_value == 0);
+    REQUIRE_FALSE(stripped_value != 0);
+    REQUIRE_EQ(stripped_value, 4);
+    REQUIRE_EQ("abc", "abd");
+    REQUIRE_CALL(stripped_mock).times(2);
+    stripped_mock();
+    yatf::sequence seq;
+    REQUIRE_CALL(stripped_sink).for_arguments(1).in_sequence(seq);
+    REQUIRE_CALL(stripped_sink).for_arguments(2).in_sequence(seq);
+    stripped_sink(2);
+    stripped_sink(1);
+}
+
+std::string output;
+
+int output_printf(const char *fmt, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, fmt);
+    auto i = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    output += line;
+    return i;
+}
+
+} // namespace anon
+
+BOOST_AUTO_TEST_SUITE(strip_strings_suite)
+
+BOOST_FIXTURE_TEST_CASE(can_symbolize_stripped_assertions, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<strip__failing>("strip", "failing"));
+    test_session::get().initialize(output_printf);
+    output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 0, "strip.*"}), 1);
+    BOOST_CHECK(output.find("stripped_value") == std::string::npos);
+    BOOST_CHECK(output.find("assertion failed: site ") != std::string::npos);
+
+    yatf::tools::site_table sites;
+    BOOST_REQUIRE(sites.load("/proc/self/exe"));
+    std::istringstream in(output);
+    std::string symbolized;
+    for (std::string line; std::getline(in, line);) {
+        symbolized += yatf::tools::symbolize(sites, line) + "\n";
+    }
+    BOOST_CHECK(symbolized.find("site ") == std::string::npos);
+    for (auto message : {" 'stripped_value == 0' is false\n", " 'stripped_value != 0' is true\n",
+            " 'stripped_value' isn't '4': 3 != 4\n", " 'abc' isn't 'abd'\n",
+            " stripped_mock: expected to be called: 2; actual: 1; calls: #1()\n",
+            " stripped_sink: called out of sequence (call #3); calls: #2(2), #3(1)\n"}) {
+        auto pos = symbolized.find(message);
+        BOOST_REQUIRE_MESSAGE(pos != std::string::npos, message);
+        auto line_start = symbolized.rfind('\n', pos) + 1;
+        BOOST_CHECK(symbolized.find("strip_strings.cpp:", line_start) < pos);
+    }
+    test_session::get().initialize(print);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,7 +1,11 @@
 #include "../include/yatf.hpp"
 #include <boost/test/unit_test.hpp>
+#include <cmath>
 #include <cstdarg>
+#include <limits>
+#include <random>
 #include <string>
+#include <vector>
 #include "common.hpp"
 
 using namespace yatf::detail;
@@ -105,7 +109,7 @@ TEST(suite, name) {
 }
 
 BOOST_FIXTURE_TEST_CASE(test_can_call, yatf_fixture) {
-    auto &tc = suite_name101;
+    auto &tc = suite_name105;
     test_session::get().current_test_case(&tc);
     tc.test_body();
     auto result = get_failed();
@@ -114,5 +118,203 @@ BOOST_FIXTURE_TEST_CASE(test_can_call, yatf_fixture) {
     BOOST_CHECK_EQUAL(get_failed(), 2);
 }
 
+namespace {
+
+MOCK(int(int), aborted_mock);
+bool reached_end = false;
+
+struct aborting_test_case : public dummy_test_case {
+
+    using dummy_test_case::dummy_test_case;
+
+    void test_body() override {
+        ASSERT(true);
+        ASSERT_EQ(2, 2);
+        REQUIRE_CALL(aborted_mock).for_arguments(1).will_return(7);
+        ASSERT_FALSE(false);
+        ASSERT_EQ(1, 2);
+        reached_end = true;
+    }
+
+};
+
+int silent_printf(const char *, ...) {
+    return 0;
+}
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(fatal_assertion_aborts_test, yatf_fixture) {
+    aborting_test_case tc{"fatal", "assertion"};
+    test_session::get().initialize(silent_printf);
+    reached_end = false;
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false}, "fatal.assertion"), 1);
+    BOOST_CHECK(!reached_end);
+    test_session::get().current_test_case(&tc);
+    BOOST_CHECK_EQUAL(get_assertions(), 4);
+    BOOST_CHECK_EQUAL(get_failed(), 1);
+    BOOST_CHECK_EQUAL(aborted_mock(1), 0);
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false}, "fatal.assertion"), 1);
+    BOOST_CHECK_EQUAL(get_assertions(), 4);
+    BOOST_CHECK(!reached_end);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(fatal_assertion_outside_of_session_does_not_abort, yatf_fixture) {
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    ASSERT(false);
+    BOOST_CHECK_EQUAL(get_failed(), 1);
+    ASSERT_EQ(1, 1);
+    BOOST_CHECK_EQUAL(get_assertions(), 2);
+    BOOST_CHECK_EQUAL(get_failed(), 1);
+    reset_buffer();
+}
+
+BOOST_FIXTURE_TEST_CASE(range_assertions_report_first_mismatch, yatf_fixture) {
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    std::vector<unsigned char> a(1000), b(1000);
+    for (auto i = 0u; i < a.size(); ++i) {
+        a[i] = b[i] = static_cast<unsigned char>(i);
+    }
+    REQUIRE_MEM_EQ(a.data(), b.data(), a.size());
+    REQUIRE_RANGE_EQ(a, b);
+    BOOST_CHECK_EQUAL(get_assertions(), 2);
+    BOOST_CHECK_EQUAL(get_failed(), 0);
+    BOOST_CHECK_EQUAL(get_buffer(), "");
+    b[500] = 0xff;
+    b[503] ^= 1;
+    b[999] = 0;
+    REQUIRE_MEM_EQ(a.data(), b.data(), a.size());
+    BOOST_CHECK_EQUAL(get_assertions(), 3);
+    BOOST_CHECK_EQUAL(get_failed(), 1);
+    std::string comp("assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 3) +
+        " 'a.data()' isn't 'b.data()': 3 of 1000 differ, first at 500: "
+        "[492] ec ed ee ef f0 f1 f2 f3 f4 f5 f6 f7 f8 f9 fa fb != [492] ec ed ee ef f0 f1 f2 f3 ff f5 f6 f6 f8 f9 fa fb\n");
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    int x[] = {1, 2, 3, -1};
+    std::vector<int> y{1, 2, 5};
+    REQUIRE_RANGE_EQ(x, y);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'x' isn't 'y': sizes 4 != 3, 2 of 4 differ, first at 2: "
+        "[0] 00000001 00000002 00000003 ffffffff != [0] 00000001 00000002 00000005\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    std::vector<double> d1{1.5, 2.5, 0.25}, d2{1.5, 3, 0.5};
+    REQUIRE_RANGE_EQ(d1, d2);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'd1' isn't 'd2': 2 of 3 differ, first at 1: [1] 2.5 != [1] 3\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    BOOST_CHECK_EQUAL(get_assertions(), 5);
+    BOOST_CHECK_EQUAL(get_failed(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(memory_is_compared_like_by_bytes) {
+    std::vector<unsigned char> a(300), b(300);
+    for (auto i = 0u; i < a.size(); ++i) {
+        a[i] = b[i] = static_cast<unsigned char>(i * 7);
+    }
+    for (auto size = 0u; size <= a.size(); ++size) {
+        BOOST_CHECK_EQUAL(find_byte_mismatch(a.data(), b.data(), size), size);
+        BOOST_CHECK_EQUAL(count_byte_mismatches(a.data(), b.data(), size), 0);
+    }
+    for (auto at = 0u; at < a.size(); ++at) {
+        b[at] ^= 0x80;
+        BOOST_CHECK_EQUAL(find_byte_mismatch(a.data(), b.data(), a.size()), at);
+        BOOST_CHECK_EQUAL(find_byte_mismatch(a.data(), b.data(), at), at);
+        BOOST_CHECK_EQUAL(find_byte_mismatch(a.data() + 1, b.data() + 1, a.size() - 1), at ? at - 1 : a.size() - 1);
+        BOOST_CHECK_EQUAL(count_byte_mismatches(a.data(), b.data(), a.size()), 1);
+        b[at] ^= 0x80;
+    }
+    for (auto i = 0u; i < a.size(); i += 3) {
+        b[i] = ~a[i];
+    }
+    BOOST_CHECK_EQUAL(count_byte_mismatches(a.data(), b.data(), a.size()), 100);
+}
+
+BOOST_FIXTURE_TEST_CASE(near_assertions_report_error, yatf_fixture) {
+    dummy_test_case tc{"suite", "name"};
+    test_session::get().current_test_case(&tc);
+    auto f = 1.0f;
+    auto g = std::nextafter(std::nextafter(f, 2.0f), 2.0f);
+    REQUIRE_NEAR(1.0, 1.05, 0.1);
+    REQUIRE_NEAR(3, 4, 1);
+    REQUIRE_ULP_EQ(f, g, 2);
+    REQUIRE_ULP_EQ(0.0, -0.0, 0);
+    BOOST_CHECK_EQUAL(get_assertions(), 4);
+    BOOST_CHECK_EQUAL(get_failed(), 0);
+    BOOST_CHECK_EQUAL(get_buffer(), "");
+    REQUIRE_ULP_EQ(f, g, 1);
+    std::string comp("assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'f' isn't near 'g': 1 != 1.00000024, error 2 > 1 ulps\n");
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    REQUIRE_NEAR(0.1 + 0.2, 0.3, 0.0);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " '0.1 + 0.2' isn't near '0.3': 0.30000000000000004 != 0.29999999999999999, error 5.55112e-17 > 0\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    REQUIRE_NEAR(std::numeric_limits<double>::quiet_NaN(), 1.0, 1.0);
+    BOOST_CHECK(get_buffer().find(": nan != 1, error nan > 1\n") != std::string::npos);
+    reset_buffer();
+    BOOST_CHECK_EQUAL(get_failed(), 3);
+
+    std::vector<float> a(1000, 1.0f), b(a);
+    REQUIRE_RANGE_NEAR(a, b, 0);
+    REQUIRE_RANGE_ULP_EQ(a, b, 0);
+    BOOST_CHECK_EQUAL(get_failed(), 3);
+    b[10] = 1.5f;
+    b[700] = 3.0f;
+    b[999] = 1.0001f;
+    REQUIRE_RANGE_NEAR(a, b, 0.01);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'a' isn't near 'b': 2 of 1000 differ, max error 2 > 0.01 at 700: 1 != 3\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    REQUIRE_RANGE_ULP_EQ(a, b, 4);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'a' isn't near 'b': 3 of 1000 differ, max error 12582912 > 4 ulps at 700: 1 != 3\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    reset_buffer();
+    std::vector<double> c{1, 2}, d{1, 2, 3};
+    REQUIRE_RANGE_NEAR(c, d, 0.5);
+    comp = "assertion failed: " + std::string(__FILE__) + ":" + std::to_string(__LINE__ - 1) +
+        " 'c' isn't near 'd': sizes 2 != 3, 1 of 3 differ\n";
+    BOOST_CHECK_EQUAL(get_buffer(), comp);
+    BOOST_CHECK_EQUAL(get_assertions(), 12);
+    BOOST_CHECK_EQUAL(get_failed(), 6);
+}
+
+BOOST_AUTO_TEST_CASE(floating_point_arrays_are_compared_like_elements) {
+    std::mt19937 rng(7);
+    const float specials[] = {0.0f, -0.0f, 1.0f, -1.0f, std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+        std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::max()};
+    for (auto round = 0; round < 2000; ++round) {
+        std::vector<float> a(rng() % 70), b(a.size());
+        std::vector<double> c(a.size()), d(a.size());
+        for (auto i = 0u; i < a.size(); ++i) {
+            a[i] = rng() % 8 ? std::ldexp(static_cast<float>(rng() % 2000) - 1000, -7) : specials[rng() % 9];
+            b[i] = rng() % 4 ? a[i] : rng() % 2 ? std::nextafter(a[i], 1e30f) : specials[rng() % 9];
+            c[i] = a[i];
+            d[i] = b[i];
+        }
+        auto tolerance = rng() % 2 ? 0.0f : 1e-6f;
+        std::uint64_t max_ulps = rng() % 3 ? rng() % 3 : 0x100000000ull;
+        BOOST_CHECK_EQUAL(find_not_near(a.data(), b.data(), a.size(), tolerance),
+            (find_not_near<float, float, float>(a.data(), b.data(), a.size(), tolerance)));
+        BOOST_CHECK_EQUAL(find_not_near(c.data(), d.data(), c.size(), static_cast<double>(tolerance)),
+            (find_not_near<double, double, double>(c.data(), d.data(), c.size(), tolerance)));
+        BOOST_CHECK_EQUAL(find_not_ulp_equal(a.data(), b.data(), a.size(), max_ulps),
+            find_not_ulp_equal<float>(a.data(), b.data(), a.size(), max_ulps));
+    }
+    BOOST_CHECK_EQUAL(ulp_distance(-0.0f, 0.0f), 0u);
+    BOOST_CHECK_EQUAL(ulp_distance(-std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::denorm_min()),
+        2u);
+    BOOST_CHECK_EQUAL(ulp_distance(1.0, std::nextafter(1.0, 0.0)), 1u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -1,6 +1,18 @@
 #include "../include/yatf.hpp"
 #include <boost/test/unit_test.hpp>
+#include <atomic>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <memory>
@@ -19,6 +31,10 @@ BOOST_AUTO_TEST_CASE(can_return_message) {
     BOOST_CHECK_EQUAL(result, "[  PASS  ]");
     result = test_session::messages::get(test_session::messages::msg::fail);
     BOOST_CHECK_EQUAL(result, "[  FAIL  ]");
+    result = test_session::messages::get(test_session::messages::msg::crash);
+    BOOST_CHECK_EQUAL(result, "[ CRASH  ]");
+    result = test_session::messages::get(test_session::messages::msg::timeout);
+    BOOST_CHECK_EQUAL(result, "[TIMEOUT ]");
 }
 
 namespace {
@@ -98,6 +114,773 @@ BOOST_FIXTURE_TEST_CASE(can_run_one_test, yatf_fixture) {
     test_session::get().initialize(print);
 }
 
+namespace {
+
+std::string parallel_output;
+
+int collecting_printf(const char *fmt, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, fmt);
+    auto i = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    parallel_output += line;
+    return i;
+}
+
+std::vector<std::string> split_lines(const std::string &str) {
+    std::vector<std::string> lines;
+    std::istringstream stream(str);
+    std::string line;
+    while (std::getline(stream, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(can_run_tests_in_parallel, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    std::vector<std::string> names;
+    auto failed = 0;
+    for (auto i = 0; i < 256; ++i) {
+        names.push_back("p" + std::to_string(i));
+    }
+    for (auto i = 0; i < 256; ++i) {
+        if (i % 3) {
+            tests.push_back(std::make_unique<suite__passing_test_case>("parallel", names[i].c_str()));
+        }
+        else {
+            ++failed;
+            tests.push_back(std::make_unique<suite__failing_test_case>("parallel", names[i].c_str()));
+        }
+    }
+    // Checks that output of each test forms a block and that each test is
+    // run exactly once; returns the blocks (without durations) and lines
+    // of the session
+    auto collect = [](std::map<std::string, std::string> &results, std::vector<std::string> &session) {
+        std::map<std::string, int> runs;
+        std::string current;
+        for (const auto &line : split_lines(parallel_output)) {
+            if (line.compare(0, 10, "[  RUN   ]") == 0) {
+                BOOST_CHECK(current.empty());
+                current = line.substr(11);
+                ++runs[current];
+            }
+            else if (line.compare(0, 10, "[  PASS  ]") == 0 || line.compare(0, 10, "[  FAIL  ]") == 0) {
+                BOOST_CHECK_EQUAL(line.substr(11, current.size()), current);
+                results[current] += line.substr(0, line.rfind(','));
+                current.clear();
+            }
+            else if (line.compare(0, 10, "[========]") == 0) {
+                session.push_back(line);
+            }
+            else {
+                BOOST_CHECK(!current.empty());
+                results[current] += line + "\n";
+            }
+        }
+        for (const auto &run : runs) {
+            BOOST_CHECK_MESSAGE(run.second == 1, run.first << " run " << run.second << " times");
+        }
+        BOOST_CHECK_EQUAL(runs.size(), results.size());
+    };
+    test_session::get().initialize(collecting_printf);
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 0, "parallel.*"}), failed);
+    std::map<std::string, std::string> serial_results;
+    std::vector<std::string> serial_session;
+    collect(serial_results, serial_session);
+    BOOST_REQUIRE_EQUAL(serial_results.size(), names.size());
+    for (const auto &name : names) {
+        BOOST_CHECK(serial_results.count("parallel." + name));
+    }
+    for (auto jobs : {2u, 8u, 0u}) {
+        parallel_output.clear();
+        yatf::config c{false, false, false, jobs, false, 0, "parallel.*"};
+        BOOST_CHECK_EQUAL(test_session::get().run(c), failed);
+        std::map<std::string, std::string> results;
+        std::vector<std::string> session;
+        collect(results, session);
+        BOOST_CHECK(results == serial_results);
+        BOOST_CHECK(session == serial_session);
+    }
+    BOOST_CHECK(failed > 0);
+    test_session::get().initialize(print);
+}
+
+namespace {
+
+struct crashing_test_case : public dummy_test_case {
+
+    using dummy_test_case::dummy_test_case;
+
+    void test_body() override {
+        REQUIRE(true);
+        std::abort();
+    }
+
+};
+
+struct hanging_test_case : public dummy_test_case {
+
+    explicit hanging_test_case(const char *sn, const char *tn, unsigned timeout = 0) : dummy_test_case(sn, tn) {
+        timeout_ms_ = timeout;
+    }
+
+    void test_body() override {
+        REQUIRE(true);
+        for (;;) {
+            pause();
+        }
+    }
+
+};
+
+struct timeout_fixture : public yatf::timeout<250> {
+};
+
+std::uint64_t fake_now = 0;
+
+std::uint64_t fake_clock() {
+    return fake_now;
+}
+
+struct timed_test_case : public dummy_test_case {
+
+    explicit timed_test_case(const char *sn, const char *tn, std::uint64_t cost) : dummy_test_case(sn, tn), cost_(cost) {
+    }
+
+    void test_body() override {
+        fake_now += cost_;
+    }
+
+private:
+    std::uint64_t cost_;
+};
+
+// Assertions in a thread started by the test are counted in the test;
+// ASSERT can't leave the body from there, so it fails like REQUIRE
+template <typename Thread>
+struct threaded_test_case : public dummy_test_case {
+
+    using dummy_test_case::dummy_test_case;
+
+    void test_body() override {
+        Thread worker([] {
+            REQUIRE(true);
+            REQUIRE_EQ(1, 2);
+            ASSERT(false);
+            REQUIRE(true);
+        });
+        worker.join();
+        REQUIRE(true);
+    }
+
+};
+
+struct failure_storm_test_case : public dummy_test_case {
+
+    explicit failure_storm_test_case(const char *sn, const char *tn) : dummy_test_case(sn, tn) {
+    }
+
+    void test_body() override {
+        for (auto i = 0; i < 1234; ++i) {
+            require_true(false, "storm", "storm.cpp", 42);
+        }
+        require_true(false, "other", "storm.cpp", 43);
+        require_true(false, "other", "storm.cpp", 43);
+    }
+
+};
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(can_isolate_crashing_tests, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("isolation", "pass"));
+    tests.push_back(std::make_unique<suite__failing_test_case>("isolation", "fail"));
+    test_session::get().initialize(collecting_printf);
+    auto serial = test_session::get().run(yatf::config{false, false, false, 1});
+    tests.push_back(std::make_unique<crashing_test_case>("isolation", "crash"));
+    tests.push_back(std::make_unique<suite__passing_test_case>("isolation", "after_crash"));
+    for (auto jobs : {1u, 4u}) {
+        parallel_output.clear();
+        BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, jobs, true}), serial + 1);
+        BOOST_CHECK(parallel_output.find("[ CRASH  ] isolation.crash (signal " + std::to_string(SIGABRT)) != std::string::npos);
+        BOOST_CHECK(parallel_output.find("[  PASS  ] isolation.after_crash (4 assertions") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("[  FAIL  ] isolation.fail (5 assertions") != std::string::npos);
+    }
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, true}, "isolation.crash"), 1);
+    BOOST_CHECK(parallel_output.find("[ CRASH  ] isolation.crash") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_timeout_hanging_tests, yatf_fixture) {
+    BOOST_CHECK_EQUAL(yatf::detail::fixture_timeout<timeout_fixture>(nullptr), 250);
+    BOOST_CHECK_EQUAL(yatf::detail::fixture_timeout<empty_fixture>(nullptr), 0);
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("timeout", "pass"));
+    test_session::get().initialize(collecting_printf);
+    auto serial = test_session::get().run(yatf::config{false, false, false, 1});
+    tests.push_back(std::make_unique<hanging_test_case>("timeout", "hang"));
+    tests.push_back(std::make_unique<hanging_test_case>("timeout", "hang_with_own_timeout", 50));
+    tests.push_back(std::make_unique<suite__passing_test_case>("timeout", "after_hang"));
+    for (auto jobs : {1u, 4u}) {
+        parallel_output.clear();
+        BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, jobs, false, 100}), serial + 2);
+        BOOST_CHECK(parallel_output.find("[TIMEOUT ] timeout.hang (exceeded 100 ms)") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("[TIMEOUT ] timeout.hang_with_own_timeout (exceeded 50 ms)") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("[  PASS  ] timeout.after_hang (4 assertions") != std::string::npos);
+    }
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false}, "timeout.hang_with_own_timeout"), 1);
+    BOOST_CHECK(parallel_output.find("[TIMEOUT ] timeout.hang_with_own_timeout") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+namespace {
+
+std::atomic<unsigned> in_process_runs{0};
+
+// Counts runs visible to the session, i.e. not in forked children
+struct counted_test_case : public dummy_test_case {
+
+    using dummy_test_case::dummy_test_case;
+
+    void test_body() override {
+        REQUIRE(true);
+        ++in_process_runs;
+    }
+
+};
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(forks_only_tests_with_timeouts, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<counted_test_case>("fork", "first"));
+    tests.push_back(std::make_unique<hanging_test_case>("fork", "hang", 50));
+    tests.push_back(std::make_unique<counted_test_case>("fork", "second"));
+    test_session::get().initialize(collecting_printf);
+    for (auto jobs : {1u, 4u}) {
+        in_process_runs = 0;
+        parallel_output.clear();
+        BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, jobs, false, 0, "fork.*"}), 1);
+        BOOST_CHECK_EQUAL(in_process_runs.load(), 2u);
+        BOOST_CHECK(parallel_output.find("[TIMEOUT ] fork.hang (exceeded 50 ms)") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("[  PASS  ] fork.second") != std::string::npos);
+    }
+    in_process_runs = 0;
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, true, 0, "fork.*"}), 1);
+    BOOST_CHECK_EQUAL(in_process_runs.load(), 0u);
+    in_process_runs = 0;
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 1000, "fork.*"}), 1);
+    BOOST_CHECK_EQUAL(in_process_runs.load(), 0u);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_report_assertions_from_other_threads, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<threaded_test_case<std::thread>>("threads", "require"));
+    tests.push_back(std::make_unique<suite__passing_test_case>("threads", "pass"));
+    test_session::get().initialize(collecting_printf);
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 0, "threads.*"}), 1);
+    BOOST_CHECK(parallel_output.find("'1' isn't '2': 1 != 2") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("'false' is false") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("[  FAIL  ] threads.require (5 assertions") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("[  PASS  ] threads.pass") != std::string::npos);
+    // Workers can't tell which test started a std::thread
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 2, false, 0, "threads.*"}), -1);
+    BOOST_CHECK(parallel_output.find("error because of 4 assertions outside of tests") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_report_assertions_from_yatf_threads, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    std::vector<std::string> names;
+    for (auto i = 0; i < 32; ++i) {
+        names.push_back("t" + std::to_string(i));
+    }
+    for (auto i = 0; i < 32; ++i) {
+        if (i % 2) {
+            tests.push_back(std::make_unique<threaded_test_case<yatf::thread>>("yatf_threads", names[i].c_str()));
+        }
+        else {
+            tests.push_back(std::make_unique<suite__passing_test_case>("yatf_threads", names[i].c_str()));
+        }
+    }
+    test_session::get().initialize(collecting_printf);
+    for (auto jobs : {1u, 4u, 0u}) {
+        parallel_output.clear();
+        BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, jobs, false, 0,
+            "yatf_threads.*"}), 16);
+        for (auto i = 1; i < 32; i += 2) {
+            auto result = "[  FAIL  ] yatf_threads." + names[i] + " (5 assertions";
+            BOOST_CHECK(parallel_output.find(result) != std::string::npos);
+        }
+        BOOST_CHECK(parallel_output.find("outside of tests") == std::string::npos);
+    }
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_find_tests_by_name, yatf_fixture) {
+    std::string long_suite(1000, 's');
+    std::string long_name(2000, 'n');
+    auto first = std::make_unique<dummy_test_case>("index", "first");
+    auto duplicate = std::make_unique<dummy_test_case>("index", "first");
+    auto long_test = std::make_unique<dummy_test_case>(long_suite.c_str(), long_name.c_str());
+    BOOST_CHECK_EQUAL(test_session::get().find_test("index.first"), first.get());
+    BOOST_CHECK_EQUAL(test_session::get().find_test((long_suite + "." + long_name).c_str()), long_test.get());
+    BOOST_CHECK(test_session::get().find_test("index.firs") == nullptr);
+    BOOST_CHECK(test_session::get().find_test("index.first2") == nullptr);
+    BOOST_CHECK(test_session::get().find_test("indexfirst") == nullptr);
+    BOOST_CHECK(test_session::get().find_test("index") == nullptr);
+    BOOST_CHECK(test_session::get().find_test("") == nullptr);
+    first.reset();
+    BOOST_CHECK_EQUAL(test_session::get().find_test("index.first"), duplicate.get());
+    auto added = std::make_unique<dummy_test_case>("index", "added");
+    BOOST_CHECK_EQUAL(test_session::get().find_test("index.added"), added.get());
+    BOOST_CHECK_EQUAL(yatf::detail::hash_test_name("index", "added"), yatf::detail::hash_string("index.added"));
+}
+
+BOOST_AUTO_TEST_CASE(can_match_filter_patterns) {
+    test_filter filter;
+    BOOST_CHECK(filter.compile(nullptr));
+    BOOST_CHECK(filter.matches("any", "test"));
+    BOOST_CHECK(filter.compile("suite*.fast_*:-*.slow_*"));
+    BOOST_CHECK(filter.matches("suite", "fast_one"));
+    BOOST_CHECK(filter.matches("suite_a", "fast_"));
+    BOOST_CHECK(!filter.matches("suite", "slow_one"));
+    BOOST_CHECK(!filter.matches("other", "fast_one"));
+    BOOST_CHECK(filter.compile("-*.slow_*"));
+    BOOST_CHECK(filter.matches("other", "fast_one"));
+    BOOST_CHECK(!filter.matches("other", "slow_one"));
+    BOOST_CHECK(filter.compile("a.b:c?.d*"));
+    BOOST_CHECK(filter.matches("a", "b"));
+    BOOST_CHECK(filter.matches("c1", "d"));
+    BOOST_CHECK(filter.matches("c1", "dxy"));
+    BOOST_CHECK(!filter.matches("c", "d"));
+    BOOST_CHECK(!filter.matches("a", "bc"));
+    BOOST_CHECK(!filter.matches("ab", ""));
+    BOOST_CHECK(filter.compile("*s*.*"));
+    BOOST_CHECK(filter.matches("suite", "x"));
+    BOOST_CHECK(!filter.matches("abc", "s"));
+    std::string too_many;
+    for (auto i = 0; i <= YATF_MAX_FILTER_PATTERNS; ++i) {
+        too_many += "a:";
+    }
+    BOOST_CHECK(!filter.compile(too_many.c_str()));
+}
+
+BOOST_FIXTURE_TEST_CASE(can_run_filtered_tests, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("filtered", "fast_pass"));
+    tests.push_back(std::make_unique<suite__failing_test_case>("filtered", "fast_fail"));
+    tests.push_back(std::make_unique<suite__failing_test_case>("filtered", "slow_fail"));
+    tests.push_back(std::make_unique<suite__failing_test_case>("filtered_other", "fast_fail"));
+    test_session::get().initialize(collecting_printf);
+    for (auto jobs : {1u, 4u}) {
+        parallel_output.clear();
+        BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, jobs, false, 0, "filtered.*:-*.slow_*"}), 1);
+        BOOST_CHECK(parallel_output.find("Running 2 test cases") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("Passed 1 test cases") != std::string::npos);
+        BOOST_CHECK(parallel_output.find("slow_fail") == std::string::npos);
+        BOOST_CHECK(parallel_output.find("filtered_other") == std::string::npos);
+    }
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, true, 0, "filtered*.*fail"}), 3);
+    BOOST_CHECK(parallel_output.find("Running 3 test cases") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_measure_tests_duration, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<timed_test_case>("timed", "fast", 1000));
+    tests.push_back(std::make_unique<timed_test_case>("timed", "slow", 2500000));
+    tests.push_back(std::make_unique<timed_test_case>("timed", "slowest", 1234567890));
+    tests.push_back(std::make_unique<timed_test_case>("timed", "medium", 40000));
+    test_session::get().initialize(collecting_printf, fake_clock);
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 0, "timed.*", 3}), 0);
+    BOOST_CHECK(parallel_output.find("[  PASS  ] timed.fast (0 assertions, 0.001 ms)\n") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("[  PASS  ] timed.slow (0 assertions, 2.500 ms)\n") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("[  PASS  ] timed.medium (0 assertions, 0.040 ms)\n") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("[========] Slowest 3 test cases\n"
+        "  1234.567 ms  timed.slowest\n"
+        "  2.500 ms  timed.slow\n"
+        "  0.040 ms  timed.medium\n") != std::string::npos);
+    parallel_output.clear();
+    test_session::get().initialize(collecting_printf, nullptr);
+    BOOST_CHECK_EQUAL(test_session::get().run(yatf::config{false, false, false, 1, false, 0, "timed.*", 3}), 0);
+    BOOST_CHECK(parallel_output.find("[  PASS  ] timed.fast (0 assertions)\n") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("Slowest") == std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_run_shards, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    std::vector<std::string> names;
+    for (auto i = 0; i < 64; ++i) {
+        names.push_back("s" + std::to_string(i));
+    }
+    auto failed = 0;
+    for (auto i = 0; i < 64; ++i) {
+        if (i % 4) {
+            tests.push_back(std::make_unique<suite__passing_test_case>("sharded", names[i].c_str()));
+        }
+        else {
+            ++failed;
+            tests.push_back(std::make_unique<suite__failing_test_case>("sharded", names[i].c_str()));
+        }
+    }
+    test_session::get().initialize(collecting_printf);
+    auto total_failed = 0;
+    std::string all;
+    for (auto shard = 0u; shard < 5; ++shard) {
+        parallel_output.clear();
+        yatf::config c{false, false, false, 1, false, 0, "sharded.*"};
+        c.shard_index = shard;
+        c.shard_count = 5;
+        total_failed += test_session::get().run(c);
+        BOOST_CHECK(parallel_output.find("test cases (shard " + std::to_string(shard) + " of 5)\n") != std::string::npos);
+        all += parallel_output;
+    }
+    BOOST_CHECK_EQUAL(total_failed, failed);
+    for (const auto &name : names) {
+        auto first = all.find("[  RUN   ] sharded." + name + "\n");
+        BOOST_CHECK(first != std::string::npos);
+        BOOST_CHECK(all.find("[  RUN   ] sharded." + name + "\n", first + 1) == std::string::npos);
+    }
+    yatf::config bad{false};
+    bad.shard_index = 5;
+    bad.shard_count = 5;
+    BOOST_CHECK(test_session::get().run(bad) < 0);
+    test_session::get().initialize(print);
+}
+
+namespace {
+
+std::vector<std::string> run_order(const std::string &output) {
+    std::vector<std::string> order;
+    for (const auto &line : split_lines(output)) {
+        if (line.compare(0, 10, "[  RUN   ]") == 0) {
+            order.push_back(line.substr(11));
+        }
+    }
+    return order;
+}
+
+} // namespace anon
+
+BOOST_FIXTURE_TEST_CASE(can_schedule_by_duration_history, yatf_fixture) {
+    auto history = "/tmp/yatf_history_" + std::to_string(getpid());
+    std::remove(history.c_str());
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<timed_test_case>("history", "a", 1000));
+    tests.push_back(std::make_unique<timed_test_case>("history", "b", 10000));
+    tests.push_back(std::make_unique<timed_test_case>("history", "c", 9000));
+    tests.push_back(std::make_unique<timed_test_case>("history", "d", 8000));
+    tests.push_back(std::make_unique<timed_test_case>("history", "e", 1000));
+    tests.push_back(std::make_unique<timed_test_case>("history", "f", 1000));
+    test_session::get().initialize(collecting_printf, fake_clock);
+    yatf::config c{false, false, false, 1, false, 0, "history.*"};
+    c.history = history.c_str();
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 0);
+    BOOST_CHECK((run_order(parallel_output) == std::vector<std::string>{
+        "history.a", "history.b", "history.c", "history.d", "history.e", "history.f"}));
+    std::ifstream file(history);
+    std::stringstream content;
+    content << file.rdbuf();
+    BOOST_CHECK(content.str().find("10000 history.b\n") != std::string::npos);
+    BOOST_CHECK(content.str().find("1000 history.f\n") != std::string::npos);
+
+    tests.push_back(std::make_unique<timed_test_case>("history", "new", 1000));
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 0);
+    auto order = run_order(parallel_output);
+    BOOST_REQUIRE_EQUAL(order.size(), 7);
+    // "new" has no history, so it gets the mean of the others
+    BOOST_CHECK((std::vector<std::string>(order.begin(), order.begin() + 4) == std::vector<std::string>{
+        "history.b", "history.c", "history.d", "history.new"}));
+
+    parallel_output.clear();
+    c.jobs = 3;
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 0);
+    BOOST_CHECK_EQUAL(run_order(parallel_output).size(), 7);
+    c.jobs = 1;
+
+    std::vector<std::string> shards[2];
+    for (auto shard = 0u; shard < 2; ++shard) {
+        parallel_output.clear();
+        c.shard_index = shard;
+        c.shard_count = 2;
+        BOOST_CHECK_EQUAL(test_session::get().run(c), 0);
+        shards[shard] = run_order(parallel_output);
+    }
+    // estimates: b=10000, c=9000, d=8000, a=e=f=new=1000
+    BOOST_REQUIRE_EQUAL(shards[0].size(), 5);
+    BOOST_CHECK_EQUAL(shards[0][0], "history.b");
+    BOOST_CHECK((shards[1] == std::vector<std::string>{"history.c", "history.d"}));
+    test_session::get().initialize(print);
+    std::remove(history.c_str());
+}
+
+BOOST_FIXTURE_TEST_CASE(can_limit_failure_messages, yatf_fixture) {
+    failure_storm_test_case test("storm", "test");
+    test_session::get().initialize(collecting_printf);
+    auto count = [](const std::string &str, const std::string &what) {
+        auto n = 0u;
+        for (auto pos = str.find(what); pos != std::string::npos; pos = str.find(what, pos + 1)) {
+            ++n;
+        }
+        return n;
+    };
+    parallel_output.clear();
+    yatf::config c{false, false, false, 1, false, 0, "storm.*"};
+    c.max_failures_per_site = 3;
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK_EQUAL(count(parallel_output, "storm.cpp:42 'storm'"), 3);
+    BOOST_CHECK_EQUAL(count(parallel_output, "storm.cpp:43 'other'"), 2);
+    BOOST_CHECK(parallel_output.find("... 1,231 more failures at storm.cpp:42\n[  FAIL  ] storm.test (1236 assertions")
+        != std::string::npos);
+    BOOST_CHECK(parallel_output.find("more failures at storm.cpp:43") == std::string::npos);
+    parallel_output.clear();
+    c.max_failures = 1;
+    c.max_failures_per_site = 0;
+    test_session::get().run(c);
+    BOOST_CHECK_EQUAL(count(parallel_output, "assertion failed"), 1);
+    BOOST_CHECK(parallel_output.find("... 1,233 more failures at storm.cpp:42\n"
+        "... 2 more failures at storm.cpp:43\n") != std::string::npos);
+    parallel_output.clear();
+    test_session::get().run(yatf::config{false, false, false, 1, false, 0, "storm.*"});
+    BOOST_CHECK_EQUAL(count(parallel_output, "assertion failed"), 1236);
+    BOOST_CHECK(parallel_output.find("more failures") == std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_print_asynchronously, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("async", "pass"));
+    tests.push_back(std::make_unique<suite__failing_test_case>("async", "fail"));
+    test_session::get().initialize(collecting_printf);
+    yatf::config c{false, false, false, 1, false, 0, "async.*"};
+    parallel_output.clear();
+    test_session::get().run(c);
+    auto sync_lines = split_lines(parallel_output).size();
+    parallel_output.clear();
+    c.async_output = true;
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK_EQUAL(split_lines(parallel_output).size(), sync_lines);
+    BOOST_CHECK(parallel_output.find("[  FAIL  ] async.fail") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("Failed 1 test cases\n") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(async_sink_follows_overflow_policy, yatf_fixture) {
+    auto &sink = yatf::detail::async_sink::get();
+    std::string line(YATF_ASYNC_BUFFER_SIZE * 3 / 4, 'x');
+    parallel_output.clear();
+    sink.start(collecting_printf, yatf::overflow_policy::drop, false);
+    BOOST_CHECK_EQUAL(yatf::detail::async_sink::print("%s", line.c_str()), static_cast<int>(line.size()));
+    BOOST_CHECK_EQUAL(yatf::detail::async_sink::print("%s", line.c_str()), 0);
+    BOOST_CHECK(parallel_output.empty());
+    BOOST_CHECK_EQUAL(sink.stop(), line.size());
+    BOOST_CHECK_EQUAL(parallel_output, line);
+    parallel_output.clear();
+    sink.start(collecting_printf, yatf::overflow_policy::block, false);
+    yatf::detail::async_sink::print("%s", line.c_str());
+    yatf::detail::async_sink::print("%s", line.c_str());
+    BOOST_CHECK_EQUAL(sink.stop(), 0u);
+    BOOST_CHECK_EQUAL(parallel_output, line + line);
+}
+
+namespace {
+
+// Not async-signal-safe, so it can't be used by the crash handler
+int stdio_printf(const char *, ...) {
+    std::abort();
+}
+
+} // namespace anon
+
+BOOST_AUTO_TEST_CASE(async_sink_is_drained_on_crash) {
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    auto pid = fork();
+    if (pid == 0) {
+        for (auto sig : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL}) {
+            std::signal(sig, SIG_DFL);
+        }
+        yatf::detail::async_sink::get().start(stdio_printf, yatf::overflow_policy::block, false, fdopen(fds[1], "w"));
+        yatf::detail::async_sink::print("%s", "before crash\n");
+        std::abort();
+    }
+    close(fds[1]);
+    std::string output;
+    char buf[256];
+    for (ssize_t size; (size = read(fds[0], buf, sizeof(buf))) > 0;) {
+        output.append(buf, size);
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    BOOST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    BOOST_CHECK_EQUAL(output, "before crash\n");
+}
+
+namespace {
+
+// Crashes once the consumer of --async output has taken all of it
+struct segfaulting_test_case : public dummy_test_case {
+
+    using dummy_test_case::dummy_test_case;
+
+    void test_body() override {
+        REQUIRE(true);
+        while (!yatf::detail::async_sink::get().empty()) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::raise(SIGSEGV);
+    }
+
+};
+
+} // namespace anon
+
+BOOST_AUTO_TEST_CASE(async_output_is_kept_in_file_on_crash) {
+    auto path = "/tmp/yatf_async_" + std::to_string(getpid());
+    auto out = "--out=" + path;
+    // Output goes either to stdout redirected to the file or to --out
+    const char *options[] = {nullptr, out.c_str()};
+    for (auto option : options) {
+        std::remove(path.c_str());
+        auto pid = fork();
+        if (pid == 0) {
+            for (auto sig : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL}) {
+                std::signal(sig, SIG_DFL);
+            }
+            auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+            suite__passing_test_case t1("crash_file", "p1");
+            suite__passing_test_case t2("crash_file", "p2");
+            suite__passing_test_case t3("crash_file", "p3");
+            segfaulting_test_case t4("crash_file", "segv");
+            const char *argv[] = {"tests", "--no-color", "--async", "--filter=crash_file.*", option};
+            yatf::main(printf, option ? 5 : 4, argv);
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        BOOST_CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+        std::ifstream file(path);
+        std::stringstream content;
+        content << file.rdbuf();
+        BOOST_CHECK(content.str().find("[  PASS  ] crash_file.p1") != std::string::npos);
+        BOOST_CHECK(content.str().find("[  PASS  ] crash_file.p3") != std::string::npos);
+        BOOST_CHECK(content.str().find("[  RUN   ] crash_file.segv\n") != std::string::npos);
+    }
+    std::remove(path.c_str());
+}
+
+BOOST_FIXTURE_TEST_CASE(can_report_in_junit_json_and_tap, yatf_fixture) {
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<timed_test_case>("report", "pass", 2500000));
+    tests.push_back(std::make_unique<suite__failing_test_case>("report", "fail"));
+    test_session::get().initialize(collecting_printf, fake_clock);
+    yatf::config c{false, false, false, 1, false, 0, "report.*"};
+    c.reporter = yatf::reporter_type::junit;
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK_EQUAL(parallel_output.find("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<testsuite name=\"yatf\" tests=\"2\">\n"
+        "  <testcase classname=\"report\" name=\"pass\" time=\"0.002500\"/>\n"
+        "  <testcase classname=\"report\" name=\"fail\" time=\"0.000000\">\n"
+        "    <failure message=\""), 0u);
+    BOOST_CHECK(parallel_output.find("&apos;false&apos; is false\" type=\"assertion\">3 of 5 assertions failed"
+        "</failure>\n  </testcase>\n</testsuite>\n") != std::string::npos);
+
+    c.reporter = yatf::reporter_type::json;
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    auto lines = split_lines(parallel_output);
+    BOOST_REQUIRE_EQUAL(lines.size(), 9u);
+    BOOST_CHECK_EQUAL(lines[0], "{\"event\":\"session_start\",\"tests\":2}");
+    BOOST_CHECK_EQUAL(lines[2], "{\"event\":\"test_end\",\"suite\":\"report\",\"name\":\"pass\",\"result\":\"pass\","
+        "\"assertions\":0,\"failed\":0,\"duration_ms\":2.500}");
+    BOOST_CHECK(lines[6].find("\"message\":\"'1' isn't '0': 1 != 0\"}") != std::string::npos);
+    BOOST_CHECK_EQUAL(lines[8], "{\"event\":\"session_end\",\"passed\":1,\"failed\":1}");
+
+    c.reporter = yatf::reporter_type::tap;
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK_EQUAL(parallel_output.find("TAP version 13\n1..2\nok - report.pass\nnot ok - report.fail\n"
+        "# assertion failed: "), 0u);
+    lines = split_lines(parallel_output);
+    BOOST_REQUIRE_EQUAL(lines.size(), 7u);
+    BOOST_CHECK_EQUAL(lines[5].find("# assertion failed: "), 0u);
+    BOOST_CHECK(lines[6].find("'1' isn't '0': 1 != 0") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(can_write_report_to_file, yatf_fixture) {
+    auto path = "/tmp/yatf_report_" + std::to_string(getpid());
+    auto out = "--out=" + path;
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("report", "pass"));
+    tests.push_back(std::make_unique<crashing_test_case>("report", "crash"));
+    const char *argv[] = {"tests", "--reporter=junit", out.c_str(), "--isolate", "--filter=report.*"};
+    auto c = yatf::read_config(5, argv);
+    BOOST_CHECK(c.reporter == yatf::reporter_type::junit);
+    test_session::get().initialize(collecting_printf);
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), 1);
+    BOOST_CHECK(parallel_output.empty());
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    BOOST_CHECK(content.str().find("<testcase classname=\"report\" name=\"pass\"") != std::string::npos);
+    BOOST_CHECK(content.str().find("<error message=\"signal " + std::to_string(SIGABRT) + "\" type=\"crash\"/>")
+        != std::string::npos);
+    BOOST_CHECK(content.str().find("</testsuite>\n") != std::string::npos);
+    std::remove(path.c_str());
+    c.out = "/nonexistent/report.xml";
+    BOOST_CHECK_EQUAL(test_session::get().run(c), -1);
+    BOOST_CHECK(parallel_output.find("error because of bad output file") != std::string::npos);
+    test_session::get().initialize(print);
+}
+
+BOOST_FIXTURE_TEST_CASE(rejects_malformed_options, yatf_fixture) {
+    const char *good[] = {"tests", "--jobs=4", "--timeout=250", "--max-failures-per-site=0"};
+    auto c = yatf::read_config(4, good);
+    BOOST_CHECK(c.bad_option == nullptr);
+    BOOST_CHECK_EQUAL(c.jobs, 4u);
+    BOOST_CHECK_EQUAL(c.timeout_ms, 250u);
+    BOOST_CHECK_EQUAL(c.max_failures_per_site, 0u);
+    for (auto option : {"--jobs=x", "--jobs=", "--jobs=2x", "--shard-count=foo", "--timeout=abc", "--timeout=-1",
+            "--max-failures=99999999999", "--reporter=xml"}) {
+        const char *argv[] = {"tests", option};
+        c = yatf::read_config(2, argv);
+        BOOST_CHECK(c.bad_option == option);
+    }
+    std::vector<std::unique_ptr<test_session::test_case>> tests;
+    tests.push_back(std::make_unique<suite__passing_test_case>("options", "pass"));
+    const char *argv[] = {"tests", "--filter=options.*", "--jobs=x"};
+    c = yatf::read_config(3, argv);
+    test_session::get().initialize(collecting_printf);
+    parallel_output.clear();
+    BOOST_CHECK_EQUAL(test_session::get().run(c), -1);
+    BOOST_CHECK(parallel_output.find("error because of bad option --jobs=x") != std::string::npos);
+    BOOST_CHECK(parallel_output.find("options.pass") == std::string::npos);
+    test_session::get().initialize(print);
+}
+
 BOOST_FIXTURE_TEST_CASE(can_be_created, yatf_fixture) {
     test_session ts;
 }
@@ -0,0 +1,404 @@
+#pragma once
+
+#include "../include/yatf.hpp"
+#include <elf.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace yatf {
+
+namespace tools {
+
+struct call_site final {
+    std::string file;
+    unsigned line;
+    std::string first;
+    std::string second;
+};
+
+// Call site records of a little-endian ELF image built with
+// YATF_CALL_SITES; sites are looked up in every allocated section, as
+// records of assertions in templates may end up in .rodata
+struct site_table final {
+
+    bool load(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        image_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        sections_.clear();
+        has_anchor_ = false;
+        if (image_.size() < EI_NIDENT || std::memcmp(image_.data(), ELFMAG, SELFMAG) ||
+                image_[EI_DATA] != ELFDATA2LSB) {
+            return false;
+        }
+        if (image_[EI_CLASS] == ELFCLASS32) {
+            return load_sections<Elf32_Ehdr, Elf32_Shdr>();
+        }
+        if (image_[EI_CLASS] == ELFCLASS64) {
+            return load_sections<Elf64_Ehdr, Elf64_Shdr>();
+        }
+        return false;
+    }
+
+    bool find(std::int32_t id, call_site &site) const {
+        if (!id || !has_anchor_) {
+            return false;
+        }
+        auto address = anchor_ + static_cast<std::int64_t>(id);
+        for (const auto &section : sections_) {
+            if (address < section.address || address >= section.address + section.size) {
+                continue;
+            }
+            auto offset = section.offset + (address - section.address);
+            auto end = section.offset + section.size;
+            std::uint32_t line;
+            if (offset + sizeof(line) > end) {
+                return false;
+            }
+            std::memcpy(&line, &image_[offset], sizeof(line));
+            site.line = line;
+            offset += sizeof(line);
+            for (auto str : {&site.file, &site.first, &site.second}) {
+                str->clear();
+                while (offset < end && image_[offset]) {
+                    *str += image_[offset++];
+                }
+                ++offset;
+            }
+            return offset <= end;
+        }
+        return false;
+    }
+
+private:
+    struct section final {
+        std::uint64_t address;
+        std::uint64_t size;
+        std::uint64_t offset;
+    };
+
+    template <typename Header, typename SectionHeader>
+    bool load_sections() {
+        Header header;
+        if (image_.size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, image_.data(), sizeof(header));
+        if (header.e_shoff + header.e_shnum * sizeof(SectionHeader) > image_.size() || header.e_shstrndx >= header.e_shnum) {
+            return false;
+        }
+        std::vector<SectionHeader> headers(header.e_shnum);
+        std::memcpy(headers.data(), &image_[header.e_shoff], header.e_shnum * sizeof(SectionHeader));
+        const auto &names = headers[header.e_shstrndx];
+        for (const auto &h : headers) {
+            if (!(h.sh_flags & SHF_ALLOC) || h.sh_type == SHT_NOBITS || h.sh_offset + h.sh_size > image_.size()) {
+                continue;
+            }
+            sections_.push_back(section{h.sh_addr, h.sh_size, h.sh_offset});
+            if (names.sh_offset + h.sh_name < image_.size() &&
+                    !std::strcmp(&image_[names.sh_offset + h.sh_name], "yatf_sites")) {
+                anchor_ = h.sh_addr;
+                has_anchor_ = true;
+            }
+        }
+        return true;
+    }
+
+    std::vector<char> image_;
+    std::vector<section> sections_;
+    std::uint64_t anchor_ = 0;
+    bool has_anchor_ = false;
+};
+
+// Turns "site <id>" printed by tests built with YATF_STRIP_STRINGS back
+// into the location and the expression of the call site, which is told
+// by the words following the id
+inline std::string symbolize(const site_table &sites, const std::string &line) {
+    static const std::string token = "site ";
+    std::string result;
+    std::size_t pos = 0;
+    for (auto found = line.find(token); found != std::string::npos; found = line.find(token, pos)) {
+        auto begin = found + token.size();
+        auto end = begin < line.size() && line[begin] == '-' ? begin + 1 : begin;
+        while (end < line.size() && line[end] >= '0' && line[end] <= '9') {
+            ++end;
+        }
+        call_site site;
+        if ((found && line[found - 1] != ' ') || end == begin ||
+                !sites.find(static_cast<std::int32_t>(std::strtol(line.c_str() + begin, nullptr, 10)), site)) {
+            result.append(line, pos, begin - pos);
+            pos = begin;
+            continue;
+        }
+        result.append(line, pos, found - pos);
+        result += site.file + ":" + std::to_string(site.line);
+        if (!line.compare(end, 9, " is false") || !line.compare(end, 8, " is true")) {
+            result += " '" + site.first + "'";
+        }
+        else if (!line.compare(end, 10, " not equal")) {
+            result += " '" + site.first + "' isn't '" + site.second + "'";
+            end += 10;
+        }
+        else if (!line.compare(end, 9, " not near")) {
+            result += " '" + site.first + "' isn't near '" + site.second + "'";
+            end += 9;
+        }
+        else if (!line.compare(end, 22, " expected to be called") || !line.compare(end, 23, " called out of sequence")) {
+            result += " " + site.first + ":";
+        }
+        pos = end;
+    }
+    result.append(line, pos, std::string::npos);
+    return result;
+}
+
+inline std::ostream *&current_stream() {
+    static std::ostream *stream = nullptr;
+    return stream;
+}
+
+inline int stream_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    auto str = va_arg(args, const char *);
+    va_end(args);
+    *current_stream() << str;
+    return 0;
+}
+
+// Replays the binary result stream (see config::binary_output) to
+// reporters, e.g. to rebuild the text output of a session (without
+// colors) and a JUnit XML report of it at once
+struct decoder final {
+
+    explicit decoder(const site_table &sites) : sites_(sites) {
+        printer_.initialize(stream_printf);
+    }
+
+    void add(detail::reporter &reporter, std::ostream &out) {
+        outputs_.push_back(output{&reporter, &out});
+    }
+
+    // Returns false if the stream ends before the end of the session
+    bool decode(std::istream &in) {
+        detail::binary_record record;
+        while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+            switch (record.type) {
+                case detail::binary_record::session_start:
+                    session_ = detail::session_report{static_cast<std::size_t>(record.value), 0, 0, 0};
+                    report([this](detail::reporter &r, detail::printer &out) {
+                        r.session_start(out, session_);
+                    });
+                    break;
+                case detail::binary_record::test_start:
+                    test_start(record);
+                    break;
+                case detail::binary_record::failure:
+                    failure(in, record);
+                    break;
+                case detail::binary_record::suppressed:
+                    suppressed(record);
+                    break;
+                case detail::binary_record::duration:
+                    test_.duration_ns = record.value;
+                    test_.has_duration = true;
+                    break;
+                case detail::binary_record::test_end:
+                    test_.assertions = static_cast<std::size_t>(record.value & 0xffffffffu);
+                    test_.failed = static_cast<std::size_t>(record.value >> 32);
+                    report([this](detail::reporter &r, detail::printer &out) {
+                        r.test_end(out, test_);
+                    });
+                    break;
+                case detail::binary_record::test_crash:
+                    find_test(record);
+                    report([this, &record](detail::reporter &r, detail::printer &out) {
+                        r.test_crash(out, test_, record.kind, static_cast<int>(static_cast<std::int64_t>(record.value)));
+                    });
+                    break;
+                case detail::binary_record::test_timeout:
+                    find_test(record);
+                    report([this, &record](detail::reporter &r, detail::printer &out) {
+                        r.test_timeout(out, test_, static_cast<unsigned>(record.value));
+                    });
+                    break;
+                case detail::binary_record::session_end:
+                    session_.failed = static_cast<std::size_t>(record.value);
+                    report([this](detail::reporter &r, detail::printer &out) {
+                        r.session_end(out, session_);
+                    });
+                    return true;
+                default:
+                    break;
+            }
+        }
+        return false;
+    }
+
+    unsigned failed() const {
+        return static_cast<unsigned>(session_.failed);
+    }
+
+private:
+    struct output final {
+        detail::reporter *reporter;
+        std::ostream *stream;
+    };
+
+    template <typename Function>
+    void report(Function fn) {
+        for (auto &o : outputs_) {
+            current_stream() = o.stream;
+            fn(*o.reporter, printer_);
+        }
+        current_stream() = nullptr;
+    }
+
+    // A test which crashed before sending anything (or timed out) is known
+    // only by its site
+    void find_test(const detail::binary_record &record) {
+        if (record.site == test_.site) {
+            return;
+        }
+        name_test(record.site, 0);
+        test_ = detail::test_report{suite_name_.c_str(), test_name_.c_str(), record.site, 0, 0, 0,
+            test_.duration_ns, test_.has_duration};
+    }
+
+    void test_start(const detail::binary_record &record) {
+        name_test(record.site, record.value);
+        test_ = detail::test_report{suite_name_.c_str(), test_name_.c_str(), record.site,
+            static_cast<std::uint32_t>(record.value), 0, 0, 0, false};
+        report([this](detail::reporter &r, detail::printer &out) {
+            r.test_start(out, test_);
+        });
+    }
+
+    void name_test(std::int32_t id, std::uint64_t hash) {
+        call_site site;
+        if (sites_.find(id, site)) {
+            suite_name_ = site.first;
+            test_name_ = site.second;
+        }
+        else {
+            std::ostringstream name;
+            name << "test_" << std::hex << hash;
+            suite_name_ = "unknown";
+            test_name_ = name.str();
+        }
+    }
+
+    static void print_value(detail::printer &out, const void *value) {
+        auto &record = *static_cast<const detail::binary_record *>(value);
+        if (record.kind == detail::binary_record::signed_value) {
+            out << static_cast<std::int64_t>(record.value);
+        }
+        else if (record.kind == detail::binary_record::float_value ||
+                record.kind == detail::binary_record::double_value) {
+            out << to_double(record);
+        }
+        else {
+            out << record.value;
+        }
+    }
+
+    static double to_double(const detail::binary_record &record) {
+        switch (record.kind) {
+            case detail::binary_record::signed_value:
+                return static_cast<double>(static_cast<std::int64_t>(record.value));
+            case detail::binary_record::float_value:
+            case detail::binary_record::double_value:
+                return detail::bit_cast<double>(record.value);
+            default:
+                return static_cast<double>(record.value);
+        }
+    }
+
+    static int max_digits(const detail::binary_record &record) {
+        return record.kind == detail::binary_record::double_value ? 17 : 9;
+    }
+
+    void failure(std::istream &in, const detail::binary_record &record) {
+        detail::failure_report f{};
+        for (auto i = 0u; i < record.values; ++i) {
+            detail::binary_record value;
+            in.read(reinterpret_cast<char *>(&value), sizeof(value));
+            if (i < sizeof(f.values) / sizeof(*f.values)) {
+                f.values[i] = value;
+            }
+        }
+        call_site site;
+        if (!sites_.find(record.site, site)) {
+            site = call_site{"unknown site", 0, "?", "?"};
+        }
+        f.file = site.file.c_str();
+        f.line = static_cast<int>(site.line);
+        f.site = record.site;
+        f.kind = static_cast<detail::binary_record::failure_t>(record.kind);
+        f.first = site.first.c_str();
+        f.second = site.second.c_str();
+        detail::printer::precise lhs, rhs;
+        if (f.kind == detail::binary_record::range_not_equal || f.kind == detail::binary_record::range_not_near ||
+                f.kind == detail::binary_record::range_not_ulp_equal) {
+            // Elements aren't sent, only where and how much the ranges differ
+            f.index = f.values[0].value;
+            f.mismatches = f.values[1].value;
+            f.lhs_size = f.values[2].value;
+            f.rhs_size = f.values[3].value;
+            f.error = to_double(f.values[4]);
+            f.tolerance = to_double(f.values[5]);
+        }
+        else if (f.kind == detail::binary_record::not_near || f.kind == detail::binary_record::not_ulp_equal) {
+            auto digits = detail::printer::distinct_digits(to_double(f.values[0]), to_double(f.values[1]),
+                std::max(max_digits(f.values[0]), max_digits(f.values[1])));
+            lhs = detail::printer::precise{to_double(f.values[0]), digits};
+            rhs = detail::printer::precise{to_double(f.values[1]), digits};
+            f.lhs = &lhs;
+            f.rhs = &rhs;
+            f.print_lhs = f.print_rhs = detail::print_operand<detail::printer::precise>;
+            f.error = to_double(f.values[2]);
+            f.tolerance = to_double(f.values[3]);
+        }
+        else if (f.kind == detail::binary_record::out_of_sequence) {
+            f.index = f.values[0].value;
+        }
+        else if (record.values == 2) {
+            f.value_count = 2;
+            f.lhs = &f.values[0];
+            f.rhs = &f.values[1];
+            f.print_lhs = f.print_rhs = print_value;
+        }
+        report([&](detail::reporter &r, detail::printer &out) {
+            r.failure(out, test_, f);
+        });
+    }
+
+    void suppressed(const detail::binary_record &record) {
+        call_site site{};
+        auto known = sites_.find(record.site, site);
+        report([&](detail::reporter &r, detail::printer &out) {
+            r.suppressed(out, test_, known ? site.file.c_str() : nullptr, static_cast<int>(site.line), record.site,
+                record.value);
+        });
+    }
+
+    const site_table &sites_;
+    std::vector<output> outputs_;
+    detail::printer printer_;
+    detail::session_report session_{0, 0, 0, 0};
+    detail::test_report test_{"", "", 0, 0, 0, 0, 0, false};
+    std::string suite_name_;
+    std::string test_name_;
+};
+
+} // namespace tools
+
+} // namespace yatf
@@ -0,0 +1,80 @@
+#include "decoder.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Usage: yatf-decode [--reporter=junit|json|tap|text] [--out=FILE] ELF_IMAGE < stream
+//        yatf-decode --text ELF_IMAGE < output
+// Decodes binary results of a test image built with YATF_CALL_SITES and
+// prints them as yatf's text output; the report selected with --reporter
+// is written to FILE (or to the standard output instead of the text).
+// With --text, text output of an image built with YATF_STRIP_STRINGS is
+// printed with call site ids replaced by locations and expressions
+int main(int argc, const char *argv[]) {
+    auto type = yatf::reporter_type::text;
+    const char *out = nullptr;
+    const char *image = nullptr;
+    auto text_input = false;
+    for (auto i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--text")) {
+            text_input = true;
+            continue;
+        }
+        if (auto value = yatf::detail::skip_prefix(argv[i], "--reporter=")) {
+            if (!yatf::detail::parse_reporter(value, type)) {
+                std::cerr << value << ": unknown reporter\n";
+                return 2;
+            }
+        }
+        else if (auto value = yatf::detail::skip_prefix(argv[i], "--out=")) {
+            out = value;
+        }
+        else {
+            image = argv[i];
+        }
+    }
+    if (!image) {
+        std::cerr << "usage: " << argv[0] << " [--reporter=junit|json|tap|text] [--out=FILE] ELF_IMAGE < stream\n"
+                  << "       " << argv[0] << " --text ELF_IMAGE < output\n";
+        return 2;
+    }
+    yatf::tools::site_table sites;
+    if (!sites.load(image)) {
+        std::cerr << image << ": not a little-endian ELF file\n";
+        return 2;
+    }
+    if (text_input) {
+        for (std::string line; std::getline(std::cin, line);) {
+            std::cout << yatf::tools::symbolize(sites, line) << "\n";
+        }
+        return 0;
+    }
+    yatf::detail::dynamic_reporter<yatf::detail::text_reporter> text;
+    yatf::detail::dynamic_reporter<yatf::detail::junit_reporter> junit;
+    yatf::detail::dynamic_reporter<yatf::detail::json_reporter> json;
+    yatf::detail::dynamic_reporter<yatf::detail::tap_reporter> tap;
+    yatf::detail::reporter *reporters[] = {&text, &junit, &json, &tap};
+    auto &selected = *reporters[static_cast<int>(type)];
+    text.get().configure(false, false, false);
+    yatf::tools::decoder decoder(sites);
+    std::ofstream file;
+    if (out) {
+        file.open(out);
+        if (!file) {
+            std::cerr << out << ": cannot open\n";
+            return 2;
+        }
+        if (&selected != &text) {
+            decoder.add(text, std::cout);
+        }
+        decoder.add(selected, file);
+    }
+    else {
+        decoder.add(selected, std::cout);
+    }
+    if (!decoder.decode(std::cin)) {
+        std::cerr << "stream ended before the end of the session\n";
+        return 2;
+    }
+    return decoder.failed() ? 1 : 0;
+}